@@ -37,7 +37,18 @@ SOURCES     +=  main.cpp\
                 hotkeys.cpp \
                 timelineInput.cpp \
                 timelineAudio.cpp \
-                events.cpp
+                events.cpp \
+                glextensions.cpp \
+                keyframecache.cpp \
+                inkatlas.cpp \
+                glstate.cpp \
+                spatialindex.cpp \
+                startuptimer.cpp \
+                gpuresources.cpp \
+                drawlist.cpp \
+                spritegenerator.cpp \
+                eventregistry.cpp \
+                subeventcolumns.cpp
 
 HEADERS     +=  mainwindow.h \
                 canvas.h \
@@ -49,7 +60,19 @@ HEADERS     +=  mainwindow.h \
                 options.h \
                 newproject.h \
                 upload.h \
-                hotkeys.h
+                hotkeys.h \
+                glextensions.h \
+                keyframecache.h \
+                inkatlas.h \
+                glstate.h \
+                spatialindex.h \
+                startuptimer.h \
+                gpuresources.h \
+                drawlist.h \
+                spritegenerator.h \
+                eventregistry.h \
+                subeventcolumns.h \
+                affine2d.h
 
 FORMS       +=  mainwindow.ui \
                 options.ui \
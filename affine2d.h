@@ -0,0 +1,73 @@
+#ifndef AFFINE2D_H
+#define AFFINE2D_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QMatrix4x4>
+#include <limits.h>
+
+// Transform of an event, in normalized coordinates (SHRT units / SHRT_MAX): x' = m11 x + m12 y + dx and
+// y' = m21 x + m22 y + dy. Six floats where a QMatrix4x4 takes seventeen - the shaders get one made from it.
+class Affine2D
+{
+public:
+    float m11 = 1, m12 = 0, m21 = 0, m22 = 1;
+    float dx = 0, dy = 0;
+
+    // Applied before the transform, as QMatrix4x4::translate does
+    void translate(float x, float y)
+    {
+        dx += m11 * x + m12 * y;
+        dy += m21 * x + m22 * y;
+    }
+
+    QPointF map(const QPointF &p) const
+    {
+        return QPointF(m11 * p.x() + m12 * p.y() + dx, m21 * p.x() + m22 * p.y() + dy);
+    }
+
+    // The same, for a point in SHRT units
+    QPointF mapShrt(const QPointF &p) const
+    {
+        return map(p / SHRT_MAX) * SHRT_MAX;
+    }
+
+    // Bounding rect of the transformed corners
+    QRectF mapRect(const QRectF &rect) const
+    {
+        QPointF p0 = map(rect.topLeft()), p1 = map(rect.topRight());
+        QPointF p2 = map(rect.bottomLeft()), p3 = map(rect.bottomRight());
+
+        return QRectF(QPointF(qMin(qMin(p0.x(), p1.x()), qMin(p2.x(), p3.x())), qMin(qMin(p0.y(), p1.y()), qMin(p2.y(), p3.y()))),
+                      QPointF(qMax(qMax(p0.x(), p1.x()), qMax(p2.x(), p3.x())), qMax(qMax(p0.y(), p1.y()), qMax(p2.y(), p3.y()))));
+    }
+
+    // Identity if it can't be inverted, like QMatrix4x4::inverted
+    Affine2D inverted() const
+    {
+        Affine2D inverse;
+
+        float det = m11 * m22 - m12 * m21;
+
+        if (det == 0) return inverse;
+
+        inverse.m11 =  m22 / det;
+        inverse.m12 = -m12 / det;
+        inverse.m21 = -m21 / det;
+        inverse.m22 =  m11 / det;
+        inverse.dx = -(inverse.m11 * dx + inverse.m12 * dy);
+        inverse.dy = -(inverse.m21 * dx + inverse.m22 * dy);
+
+        return inverse;
+    }
+
+    QMatrix4x4 toMatrix4x4() const
+    {
+        return QMatrix4x4(m11, m12, 0, dx,
+                          m21, m22, 0, dy,
+                          0,   0,   1, 0,
+                          0,   0,   0, 1);
+    }
+};
+
+#endif
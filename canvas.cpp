@@ -5,11 +5,29 @@
 #include "canvas.h"
 #include "timeline.h"
 #include "events.h"
+#include "glextensions.h"
+#include "startuptimer.h"
+
+// In timeline.cpp
+bool startTimeLessThan(const Event* e1, const Event* e2);
 
 // Needed for Windows - probably a bug in QT
 #ifndef GL_POINT_SPRITE
 #define GL_POINT_SPRITE 0x8861
 #endif
+#ifndef GL_VERTEX_PROGRAM_POINT_SIZE
+#define GL_VERTEX_PROGRAM_POINT_SIZE 0x8642
+#endif
+
+#define PICKING_SCISSOR_RADIUS 2
+#define DEFAULT_FRAME_RATE 30
+#define DEFAULT_REDRAW_BUDGET_MSEC 12
+#define MIN_RENDER_SCALE 0.5f
+#define RENDER_SCALE_STEP 0.125f
+#define RENDER_SCALE_SAMPLE_FRAMES 60
+#define RENDER_SCALE_RAISE_DELAY 5 // In samples, after the scale had to go down
+#define BENCHMARK_FRAMES 300
+#define COMPACTION_DELAY_MSEC 2000
 
 Canvas* Canvas::si;
 
@@ -17,6 +35,11 @@ Canvas::Canvas(QWidget *parent) : QGLWidget(parent)
 {
     si = this;
 
+    connect(&frameClock, SIGNAL(timeout()), this, SLOT(frameClockTick()));
+
+    compactionTimer.setSingleShot(true);
+    connect(&compactionTimer, SIGNAL(timeout()), this, SLOT(compactSprites()));
+
 #ifdef Q_OS_MAC
     this->makeCurrent();
 #endif
@@ -25,6 +48,10 @@ Canvas::Canvas(QWidget *parent) : QGLWidget(parent)
 void Canvas::initializeGL()
 {
     INIT_OPENGL_FUNCTIONS();
+    GLExtensions::resolve();
+
+    GpuResources::init();
+    GpuResources::setEvictable(GpuResources::PICKING, this);
 
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 
@@ -36,66 +63,132 @@ void Canvas::initializeGL()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    glEnable(GL_POINT_SPRITE);
+    // The sprite shaders set gl_PointSize and read gl_PointCoord - always the case on GLES, where these enums don't exist
+    if (!GLExtensions::isES)
+    {
+        glEnable(GL_POINT_SPRITE);
+        glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+    }
 
     int ib[1];
     glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, ib);
     qDebug() << "Framebuffer max dimension: " << ib[0];
 
     strokeRenderer.init();
+
+    atlas.init();
+
+    keyframes.init();
+
+    // Setup the redraw budget - redrawBudgetSprites suits slow boards, where time is a poor measure
+    redrawBudgetMSec = QSettings().value("redrawBudgetMSec", DEFAULT_REDRAW_BUDGET_MSEC).toInt();
+    redrawBudgetSprites = QSettings().value("redrawBudgetSprites", 0).toInt();
+
+    // Setup the render scale - resizeGL comes next and sizes the atlas with it
+    configuredRenderScale = qBound(MIN_RENDER_SCALE, QSettings().value("renderScale", 1.0f).toFloat(), 1.0f);
+    renderScale = maxRenderScale = configuredRenderScale;
+    autoRenderScale = QSettings().value("autoRenderScale", false).toBool();
+
+    // Setup sprite compaction - the share of dead sprites that makes it worth moving the others
+    spriteCompactionThreshold = QSettings().value("spriteCompactionThreshold", 0.25f).toFloat();
+
+    logFrameStats = QSettings().value("logFrameStats", false).toBool();
+
+    // Setup the benchmark - every frame redraws the whole lecture at once
+    if (QCoreApplication::arguments().contains("--benchmark"))
+    {
+        benchmarkFramesLeft = BENCHMARK_FRAMES;
+        redrawBudgetMSec = redrawBudgetSprites = 0;
+        autoRenderScale = false;
+    }
+
+    StartupTimer::mark("OpenGL initialized");
 }
 
 void Canvas::paintGL()
 {
+    if (benchmarkFramesLeft > 0)
+    {
+        redrawRequested = true;
+        benchmarkTimer.start();
+    }
+
+    strokeRenderer.uploadPendingSprites();
+
+    strokeRenderer.pollPicking();
+
     clearScreen();
 
     if (pickingRequested)
     {
+        if (pickingFramebufferID == (GLuint)-1) setupPickingFramebuffer();
+
         glBindFramebuffer(GL_FRAMEBUFFER, pickingFramebufferID);
 
+        // Only the pixels around the pen matter
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(penIntPos.x() - PICKING_SCISSOR_RADIUS, h - penIntPos.y() - PICKING_SCISSOR_RADIUS,
+                  PICKING_SCISSOR_RADIUS * 2 + 1, PICKING_SCISSOR_RADIUS * 2 + 1);
+
         clearScreen();
 
+        // The picking pass is drawn all at once, from the start
+        bool wasRedrawing = Timeline::si->redrawing;
+
         Timeline::si->redrawScreen();
+        strokeRenderer.flushStrokeBatch();
+
+        glDisable(GL_SCISSOR_TEST);
 
         strokeRenderer.processPicking();
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
         pickingRequested = false;
-        redrawRequested = true;
+
+        // It took over the resume point, so start the interrupted redraw again - its keyframes are kept
+        if (wasRedrawing) redrawRequested = true;
     }
+    // A redraw still in progress may have drawn the damaged events already, so start it over instead
+    if (damaged && Timeline::si->redrawing) redrawRequested = true;
+
     if (redrawRequested)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, canvasFramebufferID);
+        atlas.clear();
 
-        clearScreen();
-
-        Timeline::si->redrawScreen();
-
-        if (MainWindow::si->activeTool == MainWindow::si->POINTER_TOOL && Event::activeEvent)
-        {
-            strokeRenderer.renderSelectionRect(Event::activeEvent->getSelectionRect());
-        }
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        Timeline::si->beginRedraw();
 
         redrawRequested = false;
+        damaged = false;
+    }
+    else if (damaged)
+    {
+        redrawDamage();
+    }
+    if (Timeline::si->redrawing)
+    {
+        // Big projects are drawn over several frames, showing what's done so far, so the UI doesn't freeze
+        Timeline::si->continueRedraw(redrawBudgetMSec, redrawBudgetSprites);
+        strokeRenderer.flushStrokeBatch();
     }
     else if (incrementalDrawRequested || Timeline::si->isPlaying)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, canvasFramebufferID);
-
         Timeline::si->incrementalDraw();
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        strokeRenderer.flushStrokeBatch();
 
         incrementalDrawRequested = false;
     }
 
-    //Draw the fbo
-    glBindTexture(GL_TEXTURE_2D, canvasTextureID);
-    strokeRenderer.drawTexturedRect(-1.0, 1.0, 2.0, -2.0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Draw the visible part of the page
+    atlas.drawVisible(strokeRenderer.viewportYStart);
+
+    if (Event::draggedEvent) drawDraggedEvent();
+
+    // The selection is drawn over the ink, so it can change without redrawing it
+    if (MainWindow::si->activeTool == MainWindow::si->POINTER_TOOL && Event::activeEvent)
+    {
+        strokeRenderer.renderSelectionRect(Event::activeEvent->getSelectionRect());
+    }
 
     //If playing the video, draw a cursor:
     if(Timeline::si->isPlaying)
@@ -103,8 +196,340 @@ void Canvas::paintGL()
         strokeRenderer.drawCursor();
     }
 
-//    updateFPS();
-    if (!MainWindow::si->childWindowOpen) update();
+    if (logFrameStats) updateFPS();
+
+    adaptRenderScale();
+
+    if (benchmarkFramesLeft > 0) benchmarkFrame();
+
+    if (!firstFrameDrawn)
+    {
+        firstFrameDrawn = true;
+        StartupTimer::mark("first canvas frame drawn");
+    }
+
+    // Keep polling until the picking result arrives, and keep going until the redraw is done
+    if (strokeRenderer.pickingPending || Timeline::si->redrawing) update();
+}
+
+void Canvas::requestRedraw()
+{
+    redrawRequested = true;
+    update();
+}
+
+void Canvas::requestDamageRedraw(const QRectF &rect)
+{
+    if (damaged)
+    {
+        damage.setCoords(qMin(damage.left(), rect.left()), qMax(damage.top(), rect.top()),
+                         qMax(damage.right(), rect.right()), qMin(damage.bottom(), rect.bottom()));
+    }
+    else
+    {
+        damage = rect;
+        damaged = true;
+    }
+
+    update();
+}
+
+// Clear the damaged part of the page and draw again only the strokes that touch it
+void Canvas::redrawDamage()
+{
+    atlas.setScissor(atlas.mapToPage(damage));
+    atlas.clear();
+
+    Timeline::si->redrawRegion(damage);
+    strokeRenderer.flushStrokeBatch();
+
+    atlas.clearScissor();
+
+    damaged = false;
+}
+
+void Canvas::setRenderScale(float scale)
+{
+    scale = qBound(MIN_RENDER_SCALE, scale, 1.0f);
+
+    if (scale == renderScale) return;
+
+    renderScale = scale;
+
+    makeCurrent();
+    resizeAtlas();
+
+    requestRedraw();
+}
+
+// Create the full page ink atlas at the render scale - the picking framebuffer stays at window size,
+// so pen positions need no scaling there
+void Canvas::resizeAtlas()
+{
+    // Lower the render scale until the atlas fits the GPU memory budget - the keyframes make room first.
+    // The atlas itself isn't evictable: it is drawn into while sprites and segments reserve their memory.
+    // Scales that didn't fit aren't tried again by the auto mode until the window is resized
+    for (;;)
+    {
+        int atlasW = qMax(qRound(w * renderScale), 1);
+        qint64 bytes = (qint64)atlasW * atlasW * strokeRenderer.canvasRatio * atlas.getBytesPerPixel();
+
+        if (GpuResources::reserve(bytes - GpuResources::getBytesUsed(GpuResources::INK_ATLAS), GpuResources::INK_ATLAS)) break;
+        if (renderScale <= MIN_RENDER_SCALE) break;
+
+        renderScale = qMax(renderScale - RENDER_SCALE_STEP, MIN_RENDER_SCALE);
+        maxRenderScale = renderScale;
+    }
+
+    int atlasW = qMax(qRound(w * renderScale), 1);
+
+    atlas.resize(atlasW, atlasW * strokeRenderer.canvasRatio, w, h);
+
+    keyframes.resize();
+}
+
+// Lower the render scale while frames come later than the frame clock asks for, raise it back when they don't.
+// A new scale rebuilds the atlas and drops the keyframes, so it waits for playing or recording to stop
+void Canvas::adaptRenderScale()
+{
+    // Only frames paced by the clock say something about the GPU - big redraws are budgeted anyway
+    if (!autoRenderScale || !frameClock.isActive() || Timeline::si->redrawing)
+    {
+        frameTimer.invalidate();
+        return;
+    }
+
+    if (frameTimer.isValid())
+    {
+        sampledMSec += frameTimer.elapsed();
+        sampledFrames++;
+    }
+
+    frameTimer.start();
+
+    if (sampledFrames < RENDER_SCALE_SAMPLE_FRAMES) return;
+
+    float average = (float)sampledMSec / sampledFrames;
+    float target = frameClock.interval();
+
+    sampledMSec = 0;
+    sampledFrames = 0;
+
+    // A step from the scale in use - one slow sample is enough to go down, and then nothing raises it
+    if (average > target * 1.25f)
+    {
+        pendingRenderScale = qMax(renderScale - RENDER_SCALE_STEP, MIN_RENDER_SCALE);
+
+        raiseBlockedSamples = RENDER_SCALE_RAISE_DELAY;
+    }
+    else if (raiseBlockedSamples > 0)
+    {
+        raiseBlockedSamples--;
+    }
+    else if (average < target * 1.05f && renderScale < maxRenderScale && pendingRenderScale >= renderScale)
+    {
+        pendingRenderScale = qMin(renderScale + RENDER_SCALE_STEP, maxRenderScale);
+    }
+}
+
+// Wait for the GPU, so the frame time is the real one, and print the figures once done
+void Canvas::benchmarkFrame()
+{
+    glFinish();
+
+    benchmarkFrameTimes << benchmarkTimer.nsecsElapsed();
+
+    if (--benchmarkFramesLeft > 0)
+    {
+        update();
+        return;
+    }
+
+    qSort(benchmarkFrameTimes.begin(), benchmarkFrameTimes.end());
+
+    qint64 total = 0;
+    for (qint64 frameTime : benchmarkFrameTimes) total += frameTime;
+
+    qDebug() << "Benchmark on" << (const char*) glGetString(GL_RENDERER) << (GLExtensions::isES ? "(GLES)" : "(desktop GL)")
+             << "-" << benchmarkFrameTimes.size() << "full redraws at" << atlas.getWidth() << "x" << atlas.getPageHeight()
+             << "- render scale" << renderScale << "of at most" << maxRenderScale;
+    qDebug() << "    mean" << total / benchmarkFrameTimes.size() / 1e6 << "ms, median" << benchmarkFrameTimes[benchmarkFrameTimes.size() / 2] / 1e6
+             << "ms, 95th percentile" << benchmarkFrameTimes[benchmarkFrameTimes.size() * 95 / 100] / 1e6 << "ms";
+
+    logRendererStats();
+
+    benchmarkFrameTimes.clear();
+}
+
+void Canvas::requestIncrementalDraw()
+{
+    incrementalDrawRequested = true;
+    update();
+}
+
+void Canvas::requestPicking()
+{
+    pickingRequested = true;
+    update();
+}
+
+void Canvas::beginDrag(Event* event)
+{
+    Event::draggedEvent = event;
+
+    if (event->type == Event::STROKE_EVENT)
+    {
+        requestDamageRedraw(((PenStroke*)event)->getBounds());
+
+        liftStrokesOverDragged();
+    }
+    else requestRedraw();
+}
+
+void Canvas::liftStrokesOverDragged()
+{
+    if (!Event::draggedEvent || Event::draggedEvent->type != Event::STROKE_EVENT) return;
+
+    PenStroke* dragged = (PenStroke*)Event::draggedEvent;
+    bool lifted = false;
+
+    // The spatial index holds where the other strokes are - only the dragged one moved since it was built
+    for (Event* ev : Timeline::si->spatialIndex.query(dragged->getBounds()))
+    {
+        if (ev == dragged || ev->lifted || ev->startTime < dragged->startTime) continue;
+
+        ev->lifted = true;
+        Event::liftedEvents << ev;
+
+        // Redrawn without it, like the dragged stroke
+        requestDamageRedraw(((PenStroke*)ev)->getBounds());
+
+        lifted = true;
+    }
+
+    if (lifted) qStableSort(Event::liftedEvents.begin(), Event::liftedEvents.end(), startTimeLessThan);
+}
+
+void Canvas::endDrag()
+{
+    Event* event = Event::draggedEvent;
+
+    Event::draggedEvent = NULL;
+
+    // Put it back in its place in the drawing order, with the strokes lifted over it - where it was, the layer
+    // is already right
+    if (event->type == Event::STROKE_EVENT) requestDamageRedraw(((PenStroke*)event)->getBounds());
+    else requestRedraw();
+
+    for (Event* ev : Event::liftedEvents)
+    {
+        ev->lifted = false;
+
+        requestDamageRedraw(((PenStroke*)ev)->getBounds());
+    }
+
+    Event::liftedEvents.clear();
+}
+
+// Draw the dragged event up to the time cursor, straight to the screen - and the strokes lifted with it over it,
+// so an eraser stroke drawn after it still erases it. None of them is in the atlas, so each is drawn once
+void Canvas::drawDraggedEvent()
+{
+    if (Event::draggedEvent->type != Event::STROKE_EVENT) return;
+
+    // Keep the incremental draw where it was
+    int subeventIdx = Event::getSubeventIndex();
+
+    PenStroke* dragged = (PenStroke*)Event::draggedEvent;
+    int time = Timeline::si->timeCursorMSec;
+
+    Event::drawingDraggedEvent = true;
+
+    dragged->drawUntil(time);
+
+    for (Event* ev : Event::liftedEvents)
+    {
+        if (ev->startTime > time) break;
+
+        ((PenStroke*)ev)->drawUntil(time);
+    }
+
+    strokeRenderer.flushStrokeBatchToScreen();
+
+    Event::drawingDraggedEvent = false;
+
+    Event::setSubeventIndex(subeventIdx);
+}
+
+void Canvas::startFrameClock()
+{
+    int frameRate = qMax(QSettings().value("frameRate", DEFAULT_FRAME_RATE).toInt(), 1);
+
+    frameClock.start(1000 / frameRate);
+
+    pendingRenderScale = renderScale;
+}
+
+void Canvas::stopFrameClock()
+{
+    frameClock.stop();
+
+    // What the frames asked for while the clock ran - the page is redrawn at rest
+    if (autoRenderScale && pendingRenderScale != renderScale) setRenderScale(pendingRenderScale);
+
+    frameTimer.invalidate();
+
+    // One last frame, so the cursor is gone
+    update();
+
+    Timeline::si->update();
+}
+
+void Canvas::frameClockTick()
+{
+    if (Timeline::si->isPlaying) incrementalDrawRequested = true;
+
+    update();
+
+    Timeline::si->update();
+}
+
+void Canvas::scheduleSpriteCompaction()
+{
+    // Restarted by every edit, so a series of them is compacted once
+    compactionTimer.start(COMPACTION_DELAY_MSEC);
+}
+
+void Canvas::compactSprites()
+{
+    // The redraw holds sprite indexes between frames, and moving sprites around while drawing would stutter
+    if (Timeline::si->redrawing || Timeline::si->isRecording || Timeline::si->isPlaying || deviceDown)
+    {
+        scheduleSpriteCompaction();
+        return;
+    }
+
+    if (spriteCompactionThreshold <= 0) return;
+
+    // Clones and trims leave both dead sprites and dead segments behind, each buffer is packed on its own
+    bool compacted = false;
+
+    if (strokeRenderer.getSpritePoolStats().deadRatio >= spriteCompactionThreshold)
+    {
+        strokeRenderer.compactSprites();
+        compacted = true;
+    }
+
+    if (strokeRenderer.getDeadSegmentRatio() >= spriteCompactionThreshold)
+    {
+        strokeRenderer.compactSegments();
+        compacted = true;
+    }
+
+    if (!compacted) return;
+
+    // Nothing on the page changes - the frame uploads what moved and gives back the spare chunks
+    update();
 }
 
 void Canvas::tabletEvent(QTabletEvent *event)
@@ -236,56 +661,36 @@ void Canvas::resizeGL(int w, int h)
 
     glViewport(0, 0, w, h);
 
-    // Create canvas Framebuffer and its texture
-    if(canvasFramebufferID == -1)
-    {
-        glGenFramebuffers(1, &canvasFramebufferID);
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, canvasFramebufferID);
+    // What the budget allows depends on the window size, so the cap is found again from the configured scale
+    maxRenderScale = configuredRenderScale;
+    if (!autoRenderScale) renderScale = configuredRenderScale;
 
-    if(canvasTextureID == -1)
-    {
-        glGenTextures(1, &canvasTextureID);
-    }
-    glBindTexture(GL_TEXTURE_2D, canvasTextureID);
-
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    // Create a layer for our canvas
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, canvasTextureID, 0);
+    resizeAtlas();
 
-    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    {
-        qDebug("Canvas framebuffer not created.");
-    }
-
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    clearScreen();
+    // Made again at the new size by the next picking pass
+    releasePickingFramebuffer();
+}
 
+// The picking framebuffer is only made when something is picked, and given back when GPU memory runs short
+void Canvas::setupPickingFramebuffer()
+{
+    GpuResources::reserve((qint64)w * h * 3, GpuResources::PICKING);
 
-    // Create picking framebuffer and its texture
-    if(pickingFramebufferID == -1)
-    {
-        glGenFramebuffers(1, &pickingFramebufferID);
-    }
+    glGenFramebuffers(1, &pickingFramebufferID);
     glBindFramebuffer(GL_FRAMEBUFFER, pickingFramebufferID);
 
-    if(pickingTextureID == -1)
-    {
-        glGenTextures(1, &pickingTextureID);
-    }
+    glGenTextures(1, &pickingTextureID);
     glBindTexture(GL_TEXTURE_2D, pickingTextureID);
 
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
     // Create a layer for our canvas
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GLExtensions::isES ? GL_RGB : GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pickingTextureID, 0);
 
+    GpuResources::track(GpuResources::PICKING, GpuResources::TEXTURE, pickingTextureID, (qint64)w * h * 3);
+
     if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
     {
         qDebug("Picking framebuffer not created.");
@@ -299,6 +704,31 @@ void Canvas::resizeGL(int w, int h)
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+qint64 Canvas::releasePickingFramebuffer()
+{
+    if (pickingFramebufferID == (GLuint)-1) return 0;
+
+    qint64 bytes = GpuResources::untrack(GpuResources::TEXTURE, pickingTextureID);
+
+    glDeleteFramebuffers(1, &pickingFramebufferID);
+    glDeleteTextures(1, &pickingTextureID);
+
+    pickingFramebufferID = -1;
+    pickingTextureID = -1;
+
+    return bytes;
+}
+
+qint64 Canvas::evictGpuMemory(qint64 bytes)
+{
+    Q_UNUSED(bytes);
+
+    // Not while it's being drawn into
+    if (pickingRequested) return 0;
+
+    return releasePickingFramebuffer();
+}
+
 void Canvas::clearScreen()
 {
     glClear(GL_COLOR_BUFFER_BIT);
@@ -316,7 +746,19 @@ void Canvas::updateFPS()
         frames = 0;
 
         qDebug() << framesPerSecond + " fps";
+
+        logRendererStats();
     }
 
     frames ++;
 }
+
+void Canvas::logRendererStats()
+{
+    qDebug() << strokeRenderer.getUploadsLastFrame() << "buffer uploads last frame,"
+             << strokeRenderer.glState.getSkippedLastFrame() << "redundant GL calls skipped,"
+             << keyframes.getKeyframeCount() << "keyframes (" << keyframes.getBytesUsed() / (1024 * 1024) << "MB),"
+             << "GPU memory" << GpuResources::getReport() << ","
+             << qRound(strokeRenderer.getSpritePoolStats().deadRatio * 100) << "% dead sprites,"
+             << qRound(strokeRenderer.getDeadSegmentRatio() * 100) << "% dead segments";
+}
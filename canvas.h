@@ -14,8 +14,13 @@
 
 #include <QTime>
 #include <QTimer>
+#include <QElapsedTimer>
 
 #include "strokerenderer.h"
+#include "keyframecache.h"
+#include "inkatlas.h"
+
+class Event;
 
 #if QT_VERSION >= 0x050000
     #define EVENT_POSF event->posF();
@@ -23,7 +28,7 @@
     #define EVENT_POSF event->hiResGlobalPos() - mapToGlobal(QPoint(0,0));
 #endif
 
-class Canvas : public QGLWidget, protected OPENGL_FUNCTIONS
+class Canvas : public QGLWidget, protected OPENGL_FUNCTIONS, public GpuResources::Evictable
 {
     Q_OBJECT
 
@@ -31,12 +36,54 @@ class Canvas : public QGLWidget, protected OPENGL_FUNCTIONS
     QTime time;
     int frames = 0;
 
+    // Ticks while playing or recording - otherwise frames are only drawn when requested
+    QTimer frameClock;
+
     bool deviceDown = false;
 
+    // The logFrameStats setting - print the frame rate every few seconds
+    bool logFrameStats = false;
     void updateFPS();
 
+    // Buffer uploads, skipped GL calls, keyframes and GPU memory - with the frame rate and after a benchmark
+    void logRendererStats();
+
     void rescalePenPos();
 
+    void drawDraggedEvent();
+
+    void redrawDamage();
+
+    void resizeAtlas();
+
+    void setupPickingFramebuffer();
+    qint64 releasePickingFramebuffer(); // Returns the bytes freed
+
+    // Frame times measured while the frame clock runs, for the auto render scale
+    QElapsedTimer frameTimer;
+    qint64 sampledMSec = 0;
+    int sampledFrames = 0;
+    int raiseBlockedSamples = 0;
+
+    // Applied once the frame clock stops
+    float pendingRenderScale = 1.0f;
+
+    void adaptRenderScale();
+
+    // --benchmark: time this many full redraws and print the result
+    int benchmarkFramesLeft = 0;
+    QVector<qint64> benchmarkFrameTimes;
+    QElapsedTimer benchmarkTimer;
+
+    void benchmarkFrame();
+
+    // Reported to the StartupTimer once
+    bool firstFrameDrawn = false;
+
+    // Fires once edits have settled - the sprite buffer is compacted if enough of it is dead
+    QTimer compactionTimer;
+    float spriteCompactionThreshold = 0.25f;
+
 public:
     Canvas(QWidget* parent);
     ~Canvas();
@@ -47,17 +94,57 @@ public:
 
     StrokeRenderer strokeRenderer;
 
+    InkAtlas atlas;
+
+    KeyframeCache keyframes;
+
     bool redrawRequested = false;
     bool incrementalDrawRequested = false;
     bool pickingRequested = false;
 
+    // Ink is drawn at this fraction of the window resolution and scaled up - in auto mode it goes down
+    // by itself after playing or recording with frames coming late, and back up to maxRenderScale when they don't. maxRenderScale is the
+    // renderScale setting, lowered for as long as the atlas wouldn't fit the GPU memory budget at the window size
+    float renderScale = 1.0f, maxRenderScale = 1.0f, configuredRenderScale = 1.0f;
+    bool autoRenderScale = false;
+
+    void setRenderScale(float scale);
+
+    // How much of a redraw a single frame may do - 0 means no limit. The sprite budget counts segments with quads
+    int redrawBudgetMSec = 0;
+    int redrawBudgetSprites = 0;
+
+    // Part of the page to redraw on the next frame, in SHRT units with top being its highest y
+    QRectF damage;
+    bool damaged = false;
+
+    // Set the flag and schedule a frame
+    void requestRedraw();
+    void requestDamageRedraw(const QRectF &rect);
+    void requestIncrementalDraw();
+    void requestPicking();
+
+    void startFrameClock();
+    void stopFrameClock();
+
+    // Redraw the page without the event, which is then drawn over it every frame until the drag ends
+    void beginDrag(Event* event);
+    void endDrag();
+
+    // Take the later strokes the dragged event now overlaps out of the atlas too - after every move
+    void liftStrokesOverDragged();
+
     void clearScreen();
 
-    GLuint canvasFramebufferID = -1;
+    // After an edit left sprites no stroke draws anymore
+    void scheduleSpriteCompaction();
+
     GLuint pickingFramebufferID = -1;
-    GLuint canvasTextureID = -1;
     GLuint pickingTextureID = -1;
 
+    // Gives the picking framebuffer back
+    qint64 evictGpuMemory(qint64 bytes);
+
     QPointF penPos, lastPenPos;
     QPoint penIntPos, lastPenIntPos;
 
@@ -72,6 +159,9 @@ protected:
     void mouseReleaseEvent( QMouseEvent * event );
     void wheelEvent(QWheelEvent * event);
 
+private slots:
+    void frameClockTick();
+    void compactSprites();
 };
 
 #endif
@@ -0,0 +1,139 @@
+#include "drawlist.h"
+#include "events.h"
+
+#include <QRunnable>
+#include <QThread>
+
+#define MIN_EVENTS_PER_THREAD 256
+
+// Builds a slice of the items - they are preallocated, so the threads never touch the vector itself
+class DrawListTask : public QRunnable
+{
+    Event* const* events;
+    DrawList::Item* items;
+    int count, time;
+    DrawList::Target target;
+
+public:
+    DrawListTask(Event* const* events, DrawList::Item* items, int count, int time, const DrawList::Target &target) :
+        events(events), items(items), count(count), time(time), target(target) {}
+
+    void run()
+    {
+        for (int i = 0; i < count; i++) DrawList::buildItem(events[i], time, target, items[i]);
+    }
+};
+
+
+void DrawList::buildItem(const Event* ev, int time, const Target &target, Item &item)
+{
+    item.transform = ev->transform;
+
+    if (ev->type != Event::STROKE_EVENT)
+    {
+        item.toSubevent = item.toPb = item.primitiveCount = 0;
+        item.reachedTime = time < ev->endTime;
+        item.visible = false;
+
+        return;
+    }
+
+    const PenStroke* stroke = (const PenStroke*)ev;
+
+    item.reachedTime = stroke->getDrawnUntil(time, item.toSubevent, item.toPb);
+
+    // Counted in what the renderer actually draws - quads have no sprites, and sprites may not even be made
+    if (target.segments)
+    {
+        item.primitiveCount = stroke->subevents.size();
+    }
+    else
+    {
+        const QVector<int>& pbIdx = stroke->subevents.pbIdx;
+
+        item.primitiveCount = pbIdx.at(pbIdx.size() - 1) - stroke->pbStart;
+    }
+
+    const QRectF& bounds = stroke->getCachedBounds();
+
+    item.visible = bounds.bottom() <= target.visibleTop && bounds.top() >= target.visibleBottom;
+}
+
+
+void DrawList::build(const QVector<Event*> &events, int from, int to, int time)
+{
+    start = from;
+
+    items.resize(qMax(to - from, 0));
+
+    // Everything the workers read but the events' own data, worked out here
+    Target target;
+    target.segments = StrokeRenderer::si->drawsSegments();
+    StrokeRenderer::si->getRenderTargetRange(target.visibleTop, target.visibleBottom);
+
+    for (int i = from; i < to; i++)
+    {
+        if (events[i]->type == Event::STROKE_EVENT) ((PenStroke*)events[i])->getBounds();
+    }
+
+    Event* const* first = events.constData() + from;
+    Item* firstItem = items.data();
+
+    int threads = qBound(1, items.size() / MIN_EVENTS_PER_THREAD, QThread::idealThreadCount());
+
+    // Small lists aren't worth waking the pool for
+    if (threads == 1)
+    {
+        DrawListTask(first, firstItem, items.size(), time, target).run();
+        return;
+    }
+
+    int perThread = (items.size() + threads - 1) / threads;
+
+    for (int offset = 0; offset < items.size(); offset += perThread)
+    {
+        int count = qMin(perThread, items.size() - offset);
+
+        // The last slice is built here, while the pool does the others
+        if (offset + count == items.size())
+        {
+            DrawListTask(first + offset, firstItem + offset, count, time, target).run();
+            break;
+        }
+
+        pool.start(new DrawListTask(first + offset, firstItem + offset, count, time, target));
+    }
+
+    pool.waitForDone();
+}
+
+
+void DrawList::clear()
+{
+    items.clear();
+    start = 0;
+}
+
+
+bool DrawList::isEmpty()
+{
+    return items.isEmpty();
+}
+
+
+int DrawList::getStart()
+{
+    return start;
+}
+
+
+int DrawList::getEnd()
+{
+    return start + items.size();
+}
+
+
+const DrawList::Item& DrawList::at(int eventIdx)
+{
+    return items.at(eventIdx - start);
+}
@@ -0,0 +1,57 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include <QVector>
+#include <QThreadPool>
+
+#include "affine2d.h"
+
+class Event;
+
+// What a redraw will draw of a range of events by a given time, worked out before any GL call is made.
+// Big ranges are split between worker threads, which only read the events - the bounds cache of the strokes is
+// filled and the renderer state copied on the GL thread beforehand, and the GL thread waits for them. It then just
+// walks the items in order and submits them to the StrokeRenderer.
+class DrawList
+{
+public:
+    struct Item
+    {
+        int toSubevent, toPb;   // Strokes are drawn from their start up to these
+        int primitiveCount;     // The whole stroke in segments or sprites, as counted against the redraw budget
+        bool reachedTime;       // The time was reached inside this event - the redraw stops here
+        bool visible;           // Touches the render target
+        Affine2D transform;
+    };
+
+    // What the workers need of the renderer, copied before they start
+    struct Target
+    {
+        bool segments;                  // Drawn as quads - the budget counts segments then
+        float visibleTop, visibleBottom; // In SHRT units
+    };
+
+private:
+    QVector<Item> items;
+    int start = 0;
+
+    QThreadPool pool;
+
+public:
+    // Work out events [from, to) at the given time - it may run on any thread, and only reads the events
+    static void buildItem(const Event* ev, int time, const Target &target, Item &item);
+
+    void build(const QVector<Event*> &events, int from, int to, int time);
+
+    void clear();
+
+    bool isEmpty();
+
+    // Index of the first event in the list and one past the last
+    int getStart();
+    int getEnd();
+
+    const Item& at(int eventIdx);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "eventregistry.h"
+
+#include <QDebug>
+
+#define SLOT_MASK ((1 << SLOT_BITS) - 1)
+#define GENERATION_MASK ((1 << GENERATION_BITS) - 1)
+#define MAX_SLOTS SLOT_MASK // The last slot is never used - all bits set is the background of the picking framebuffer
+
+QVector<EventRegistry::Slot> EventRegistry::entries;
+QQueue<int> EventRegistry::freeSlots;
+int EventRegistry::count = 0;
+
+
+int EventRegistry::add(Event* event)
+{
+    int slot;
+
+    if (!freeSlots.isEmpty())
+    {
+        slot = freeSlots.dequeue();
+    }
+    else if (entries.size() < MAX_SLOTS)
+    {
+        Slot empty = {NULL, 0};
+
+        slot = entries.size();
+        entries << empty;
+    }
+    else
+    {
+        qWarning() << "Event registry full:" << count << "events";
+        return -1;
+    }
+
+    entries[slot].event = event;
+    count++;
+
+    return (entries[slot].generation << SLOT_BITS) | slot;
+}
+
+
+void EventRegistry::remove(int handle)
+{
+    if (!get(handle)) return;
+
+    Slot& entry = entries[handle & SLOT_MASK];
+
+    entry.event = NULL;
+    entry.generation = (entry.generation + 1) & GENERATION_MASK;
+    count--;
+
+    freeSlots.enqueue(handle & SLOT_MASK);
+}
+
+
+Event* EventRegistry::get(int handle)
+{
+    if (handle < 0) return NULL;
+
+    int slot = handle & SLOT_MASK;
+
+    if (slot >= entries.size()) return NULL;
+
+    const Slot& entry = entries[slot];
+
+    if (entry.generation != ((handle >> SLOT_BITS) & GENERATION_MASK)) return NULL;
+
+    return entry.event;
+}
+
+
+QVector<Event*> EventRegistry::getEvents()
+{
+    QVector<Event*> events;
+    events.reserve(count);
+
+    for (const Slot& entry : entries)
+    {
+        if (entry.event) events << entry.event;
+    }
+
+    return events;
+}
+
+
+int EventRegistry::getCount()
+{
+    return count;
+}
+
+
+int EventRegistry::getSlotCount()
+{
+    return entries.size();
+}
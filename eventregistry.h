@@ -0,0 +1,46 @@
+#ifndef EVENTREGISTRY_H
+#define EVENTREGISTRY_H
+
+#include <QVector>
+#include <QQueue>
+
+class Event;
+
+// Every live event, by a handle that stays valid until the event is deleted - Event::ID holds it.
+// Handles double as picking colors, so they fit 24 bits: 20 bits of slot and 4 bits of generation. A deleted event's
+// slot is given out again with the next generation, and a stale handle (an old picking result, say) gets NULL
+// instead of whatever took the slot. Slots are reused oldest first, so a generation takes long to come around.
+class EventRegistry
+{
+public:
+    enum { SLOT_BITS = 20, GENERATION_BITS = 4 };
+
+private:
+    struct Slot
+    {
+        Event* event;
+        int generation;
+    };
+
+    static QVector<Slot> entries;
+    static QQueue<int> freeSlots;
+    static int count;
+
+public:
+    // Returns the event's handle, or -1 if every slot is taken
+    static int add(Event* event);
+
+    // Free the handle's slot - the event itself is the caller's. Stale handles and -1 are ignored
+    static void remove(int handle);
+
+    // NULL for -1, stale handles and anything else that isn't a live event's handle
+    static Event* get(int handle);
+
+    // Live events, in no particular order
+    static QVector<Event*> getEvents();
+
+    static int getCount();
+    static int getSlotCount();
+};
+
+#endif
@@ -3,7 +3,9 @@
 int Event::subeventToDrawIdx = 0;
 QPointF Event::cursorPos;
 Event* Event::activeEvent;
-QVector<Event*> Event::allEvents;
+Event* Event::draggedEvent = NULL;
+bool Event::drawingDraggedEvent = false;
+QVector<Event*> Event::liftedEvents;
 
 Event::Event(int startT, bool isLocal) : startTime(startT)
 {
@@ -16,15 +18,25 @@ Event::Event()
     init();
 }
 
+
+Event::~Event()
+{
+    if (activeEvent == this) activeEvent = NULL;
+    if (draggedEvent == this) draggedEvent = NULL;
+    if (lifted) liftedEvents.remove(liftedEvents.indexOf(this));
+
+    EventRegistry::remove(ID);
+}
+
 #define noSelection (256*256*256-1)
 void Event::setActiveID(int ID, QPointF pressPos)
 {
-    if (ID == noSelection)
+    if (ID == noSelection || ID < 0)
     {
         activeEvent = NULL;
         return;
     }
-    activeEvent = allEvents[ID];
+    activeEvent = EventRegistry::get(ID);
 }
 
 
@@ -48,15 +60,13 @@ int Event::getSubeventIndex()
 
 void Event::deleteAllEvents()
 {
-    qDeleteAll(allEvents);
+    qDeleteAll(EventRegistry::getEvents());
 }
 
 
 void Event::init()
 {
-    ID = allEvents.size();
-    allEvents.push_back(this);
-    qDebug() << ID;
+    ID = EventRegistry::add(this);
 }
 
 
@@ -66,6 +76,8 @@ PenStroke* PenStroke::clone() const
 
     ret->init();
 
+    ret->invalidateSegments();
+
     return ret;
 }
 
@@ -76,14 +88,15 @@ void PenStroke::writeToStream(QDataStream& out)
     out << (quint8)(r * 255.0f);
     out << (quint8)(g * 255.0f);
     out << (quint8)(b * 255.0f);
+    out << (quint8)(ptSize);
     qDebug() << (quint8)(r * 255.0f)<< (quint8)(g * 255.0f)<< (quint8)(b * 255.0f);
 
-    for (Subevent se : subevents)
+    for (int i = 0; i < subevents.size(); i++)
     {
-        out << (qint32)se.t;
+        out << (qint32)subevents.t.at(i);
         out << (qint8)(STROKE_EVENT);
-        out << (qint16)se.x;
-        out << (qint16)se.y;
+        out << subevents.x.at(i);
+        out << subevents.y.at(i);
     }
 
     out << (qint32)endTime;
@@ -93,6 +106,46 @@ void PenStroke::writeToStream(QDataStream& out)
 void PenStroke::mouseDragged(QPointF deltaPos)
 {
     transform.translate(deltaPos.x()/SHRT_MAX, deltaPos.y()/SHRT_MAX);
+
+    boundsValid = false;
+}
+
+
+// Fit the selection rect to the subevents left after a trim - the bounds follow it
+void PenStroke::updateSelectionRect()
+{
+    boundsValid = false;
+
+    if (subevents.isEmpty()) return;
+
+    selectionRect.setCoords(subevents.x.at(0), subevents.y.at(0), subevents.x.at(0), subevents.y.at(0));
+
+    for (int i = 1; i < subevents.size(); i++)
+    {
+        float x = subevents.x.at(i), y = subevents.y.at(i);
+
+        if ( y > selectionRect.top()    ) selectionRect.setTop   (y);
+        if ( y < selectionRect.bottom() ) selectionRect.setBottom(y);
+        if ( x > selectionRect.right()  ) selectionRect.setRight (x);
+        if ( x < selectionRect.left()   ) selectionRect.setLeft  (x);
+    }
+}
+
+
+QRectF PenStroke::getBounds()
+{
+    if (!boundsValid)
+    {
+        float radius = StrokeRenderer::si->getPickingRadius(ptSize);
+        float radiusY = radius / StrokeRenderer::si->canvasRatio;
+
+        QRectF rect = getSelectionRect();
+        bounds.setCoords(rect.left() - radius, rect.top() + radiusY, rect.right() + radius, rect.bottom() - radiusY);
+
+        boundsValid = true;
+    }
+
+    return bounds;
 }
 
 
@@ -101,11 +154,7 @@ void PenStroke::scaleAndMove(float scale, int timeShiftMSec, int pivot)
     startTime += timeShiftMSec;
     startTime = (startTime - pivot) * scale + pivot;
 
-    for (Subevent& se : subevents)
-    {
-        se.t += timeShiftMSec;
-        se.t = (se.t - pivot) * scale + pivot;
-    }
+    subevents.scaleTimes(scale, timeShiftMSec, pivot);
 
     endTime += timeShiftMSec;
     endTime = (endTime - pivot) * scale + pivot ;
@@ -114,119 +163,208 @@ void PenStroke::scaleAndMove(float scale, int timeShiftMSec, int pivot)
 
 void PenStroke::trimRange(int from, int to, int insertIdx, QVector<Event *> &events)
 {
-    Subevent valueFrom(from, 0, 0, 0);
+    int f = subevents.lowerBound(from);
 
-    QVector<Subevent>::iterator f =
-            qLowerBound(subevents.begin(), subevents.end(), valueFrom, timeLessThan);
+    int t = subevents.lowerBound(to) + 1;
 
-    Subevent valueTo(to, 0, 0, 0);
+    if (t > subevents.size()) t--;
 
-    QVector<Subevent>::iterator t =
-            qLowerBound(subevents.begin(), subevents.end(), valueTo, timeLessThan) + 1;
+    subevents.remove(f, t);
 
-    if (t > subevents.end()) t--;
+    invalidateSegments();
+    updateSelectionRect();
 
-    subevents.erase(f, t);
-
-    startTime = subevents.first().t;
-    endTime = subevents.last().t;
+    startTime = subevents.t.first();
+    endTime = subevents.t.last();
 }
 
 
 void PenStroke::trimFrom(int from)
 {
-    Subevent value(from, 0, 0, 0);
+    int i = subevents.lowerBound(from);
 
-    QVector<Subevent>::iterator i =
-            qLowerBound(subevents.begin(), subevents.end(), value, timeLessThan);
+    subevents.remove(i, subevents.size());
 
-    subevents.erase(i, subevents.end());
+    invalidateSegments();
+    updateSelectionRect();
 
-    endTime = subevents.last().t;
+    endTime = subevents.t.last();
 }
 
 
 void PenStroke::trimUntil(int to)
 {
-    Subevent value(to, 0, 0, 0);
+    int i = subevents.lowerBound(to) + 1;
+
+    if (i > subevents.size()) i--;
 
-    QVector<Subevent>::iterator i =
-            qLowerBound(subevents.begin(), subevents.end(), value, timeLessThan) + 1;
+    // The sprites of the erased subevents aren't drawn anymore - they are left for compaction
+    if (i > 0) pbStart = subevents.pbIdx[i - 1];
 
-    if (i > subevents.end()) i--;
+    subevents.remove(0, i);
 
-    subevents.erase(subevents.begin(), i);
+    invalidateSegments();
+    updateSelectionRect();
 
     if (subevents.size() == 0) return; //TODO
 
-    startTime = subevents.first().t;
+    startTime = subevents.t.first();
 }
 
 
-bool PenStroke::drawUntil(int time)
+// Make sure there is a segment for every subevent, appending the missing ones to the StrokeRenderer
+void PenStroke::ensureSegments()
 {
-    bool reachedTimeCursor = false;
-    int to = subevents.back().pbIdx;
+    if (segCount == subevents.size()) return;
 
-    for (int i = 0; i < subevents.size(); i++)
+    // Only the last stroke in the segment buffer can keep growing in place - others are copied to the end
+    if (segStart < 0 || segStart + segCount != StrokeRenderer::si->getSegmentCount())
     {
-        if (subevents[i].t > time)
-        {
-            if (i==0)
-            {
-                to = pbStart;
-                subeventToDrawIdx = 0;
-            }
-            else
-            {
-                to = subevents[i-1].pbIdx;
-                subeventToDrawIdx = i;
-            }
-
-            reachedTimeCursor = true;
-
-            break;
-        }
+        segStart = StrokeRenderer::si->getSegmentCount();
+        segCount = 0;
+    }
+
+    for (; segCount < subevents.size(); segCount++)
+    {
+        int prev = qMax(segCount - 1, 0);
+
+        StrokeRenderer::si->addStrokeSegment(subevents.x.at(prev), subevents.y.at(prev), subevents.x.at(segCount), subevents.y.at(segCount),
+                                             r, g, b, ptSize, segCount == 1);
+    }
+}
+
+
+// Draw the subevents [fromSubevent, toSubevent) as segments, or the sprites [fromPb, toPb)
+void PenStroke::draw(int fromSubevent, int toSubevent, int fromPb, int toPb)
+{
+    // Strokes outside the page (or, when picking, the screen) are skipped
+    if (!StrokeRenderer::si->isInRenderTarget(getBounds())) return;
+
+    submit(fromSubevent, toSubevent, fromPb, toPb, transform);
+}
+
+
+void PenStroke::submit(int fromSubevent, int toSubevent, int fromPb, int toPb, const Affine2D &transform)
+{
+    // The dragged stroke and those lifted with it are only drawn over the cached layer
+    if ((this == draggedEvent || lifted) && !drawingDraggedEvent) return;
+
+    if (StrokeRenderer::si->drawsSegments())
+    {
+        if (toSubevent <= fromSubevent) return;
+
+        ensureSegments();
+
+        StrokeRenderer::si->drawStrokeSegmentsRange(segStart + fromSubevent, segStart + toSubevent, transform.toMatrix4x4());
     }
+    else if (toPb != fromPb)
+    {
+        StrokeRenderer::si->drawStrokeSpritesRange(fromPb, toPb, r, g, b, ptSize, transform.toMatrix4x4(), ID);
+    }
+}
 
-    StrokeRenderer::si->drawStrokeSpritesRange(pbStart, to, r, g, b, ptSize, transform, ID);
+
+// Whether pos (in SHRT units) is covered by the part of the stroke drawn by the given time
+bool PenStroke::hitTest(QPointF pos, int time)
+{
+    if (subevents.isEmpty() || subevents.t.at(0) > time) return false;
+
+    // Bring pos to the stroke's own coordinates
+    QPointF local = transform.inverted().mapShrt(pos);
+
+    // Measure in pixel proportions - y units are canvasRatio times smaller than x units
+    float ratio = StrokeRenderer::si->canvasRatio;
+    float radius = StrokeRenderer::si->getPickingRadius(ptSize);
+
+    float px = local.x(), py = local.y() * ratio;
+
+    // Only the positions are read past here
+    int count = subevents.upperBound(time);
+    const qint16* xs = subevents.x.constData();
+    const qint16* ys = subevents.y.constData();
+
+    for (int i = 0; i < count; i++)
+    {
+        int a = qMax(i - 1, 0);
+
+        float ax = xs[a], ay = ys[a] * ratio;
+        float dx = xs[i] - ax, dy = ys[i] * ratio - ay;
+        float len2 = dx*dx + dy*dy;
+
+        // Closest point of the segment
+        float u = len2 > 0 ? qBound(0.0f, ((px - ax) * dx + (py - ay) * dy) / len2, 1.0f) : 0;
+
+        float ex = ax + u * dx - px;
+        float ey = ay + u * dy - py;
+
+        if (ex*ex + ey*ey <= radius*radius) return true;
+    }
+
+    return false;
+}
+
+
+bool PenStroke::drawUntil(int time)
+{
+    int toSubevent, to;
+
+    bool reachedTimeCursor = getDrawnUntil(time, toSubevent, to);
+
+    if (reachedTimeCursor) subeventToDrawIdx = toSubevent;
+
+    draw(0, toSubevent, pbStart, to);
 
     return reachedTimeCursor;
 }
 
 
+bool PenStroke::getDrawnUntil(int time, int &toSubevent, int &toPb) const
+{
+    // First subevent after the time - they are sorted by it. Const access, so shared subevents aren't detached
+    toSubevent = subevents.upperBound(time);
+
+    if (toSubevent == subevents.size())
+    {
+        toPb = subevents.pbIdx.at(toSubevent-1);
+        return false;
+    }
+
+    toPb = toSubevent == 0 ? pbStart : subevents.pbIdx.at(toSubevent-1);
+    return true;
+}
+
+
 bool PenStroke::drawFromIndexUntil(int limitTime)
 {
     bool reachedLimit = false;
 
     // Draw from the index before where we stopped or from the start index, if refering to the first index
-    int from = subeventToDrawIdx == 0 ? pbStart : subevents[subeventToDrawIdx-1].pbIdx;
+    int from = subeventToDrawIdx == 0 ? pbStart : subevents.pbIdx.at(subeventToDrawIdx-1);
+
+    int fromSubevent = subeventToDrawIdx;
 
     // Starting off, we don't draw anything
     int to = from;
+    int toSubevent = fromSubevent;
 
-    // From the current subevent and on...
-    for (; subeventToDrawIdx < subevents.size(); subeventToDrawIdx++)
-    {
-        // If the subevent's timestamp goes over the limitTime
-        if (subevents[subeventToDrawIdx].t <= limitTime)
-        {
-            // Decrease the index, as we want the subevent right before going over the limitTime and get its pointBuffer index
-            to = subevents[subeventToDrawIdx].pbIdx;
+    // From the current subevent on, up to the last one not past the limitTime
+    int end = qMax(subevents.upperBound(limitTime), subeventToDrawIdx);
 
-            // Update the cursor pos
-            cursorPos = transform * QPointF(subevents[subeventToDrawIdx].x, subevents[subeventToDrawIdx].y);
-        }
-        else
-        {
-            // timeLimit was reached
-            reachedLimit = true;
+    if (end > subeventToDrawIdx)
+    {
+        // The pointBuffer index of the subevent right before going over the limitTime
+        to = subevents.pbIdx.at(end-1);
+        toSubevent = end;
 
-            // Stop looking
-            break;
-        }
+        // Update the cursor pos
+        cursorPos = subevents.pos(end-1);
     }
 
+    subeventToDrawIdx = end;
+
+    // timeLimit was reached
+    if (subeventToDrawIdx < subevents.size()) reachedLimit = true;
+
     // If last index limit has been reached
     if (subeventToDrawIdx == subevents.size())
     {
@@ -237,10 +375,11 @@ bool PenStroke::drawFromIndexUntil(int limitTime)
             subeventToDrawIdx = 0;
 
             // Finish drawing the whole event
-            to = subevents.back().pbIdx;
+            to = subevents.pbIdx.at(subevents.size()-1);
+            toSubevent = subevents.size();
 
             // Update the cursor pos
-            cursorPos = transform * QPointF(subevents.back().x, subevents.back().y);
+            cursorPos = subevents.pos(subevents.size()-1);
         }
         else
         {
@@ -249,7 +388,7 @@ bool PenStroke::drawFromIndexUntil(int limitTime)
         }
     }
 
-    if ( !(to == from) ) StrokeRenderer::si->drawStrokeSpritesRange(from, to, r, g, b, ptSize, transform, ID);
+    draw(fromSubevent, toSubevent, from, to);
 
     return reachedLimit;
 }
@@ -260,12 +399,12 @@ void PointerMovement::writeToStream(QDataStream &out)
     out << (qint32)startTime;
     out << (qint8)(POINTER_MOVEMENT_START);
 
-    for (Subevent se : subevents)
+    for (int i = 0; i < subevents.size(); i++)
     {
-        out << (qint32)se.t;
+        out << (qint32)subevents.t.at(i);
         out << (qint8)(POINTER_MOVEMENT_EVENT);
-        out << (qint16)se.x;
-        out << (qint16)se.y;
+        out << subevents.x.at(i);
+        out << subevents.y.at(i);
     }
 
     out << (qint32)endTime;
@@ -274,64 +413,53 @@ void PointerMovement::writeToStream(QDataStream &out)
 
 void PointerMovement::trimRange(int from, int to, int insertIdx, QVector<Event *> &events)
 {
-    Subevent valueFrom(from, 0, 0);
-    Subevent valueTo(to, 0, 0);
-
-    QVector<Subevent>::iterator f =
-            qLowerBound(subevents.begin(), subevents.end(), valueFrom, timeLessThan);
-    QVector<Subevent>::iterator t =
-            qLowerBound(subevents.begin(), subevents.end(), valueTo,   timeLessThan);
+    int f = subevents.lowerBound(from);
+    int t = subevents.lowerBound(to);
 
     // From refers to after the subevents
-    if (f > subevents.end()-1) return;
+    if (f > subevents.size()-1) return;
 
-    if (t > subevents.end()-1)
+    if (t > subevents.size()-1)
     {
         trimFrom(from);
         return;
     }
 
-    if ((*f).t == from) f++;
-    if ((*t).t == to  ) t--;
+    if (subevents.t.at(f) == from) f++;
+    if (subevents.t.at(t) == to  ) t--;
 
     // Create new Subevent from t to end
-    events.insert( insertIdx, (Event*)(new PointerMovement( (*t).t, endTime, subevents.mid( t - subevents.begin() ) )) );
+    events.insert( insertIdx, (Event*)(new PointerMovement( subevents.t.at(t), endTime, subevents.mid(t) )) );
 
-    subevents.erase(f, subevents.end());
+    subevents.remove(f, subevents.size());
 
-    endTime   = subevents.last().t;
+    endTime   = subevents.t.last();
 
-    subevents.last().t--;
+    subevents.t.last()--;
 }
 
 
 void PointerMovement::trimFrom(int time)
 {
-    Subevent value(time, 0, 0);
-
-    QVector<Subevent>::iterator i =
-            qLowerBound(subevents.begin(), subevents.end(), value, timeLessThan);
+    int i = subevents.lowerBound(time);
 
-    subevents.erase(i, subevents.end());
+    subevents.remove(i, subevents.size());
 
-    endTime = subevents.last().t;
+    endTime = subevents.t.last();
 }
 
 
 void PointerMovement::trimUntil(int time)
 {
-    Subevent value(time, 0, 0);
+    int i = subevents.lowerBound(time) + 1;
 
-    QVector<Subevent>::iterator i =
-            qLowerBound(subevents.begin(), subevents.end(), value, timeLessThan) + 1;
+    if (i > subevents.size()-1) i--;
 
-    if (i > subevents.end()-1) i--;
-
-    subevents.erase(subevents.begin(), i);
+    subevents.remove(0, i);
 
     if (subevents.size() == 0) return; //TODO
 
-    startTime = subevents.first().t;
+    startTime = subevents.t.first();
 }
 
 
@@ -340,11 +468,7 @@ void PointerMovement::scaleAndMove(float scale, int timeShiftMSec, int pivot)
     startTime += timeShiftMSec;
     startTime = (startTime - pivot) * scale + pivot;
 
-    for (Subevent& se : subevents)
-    {
-        se.t += timeShiftMSec;
-        se.t = (se.t - pivot) * scale + pivot;
-    }
+    subevents.scaleTimes(scale, timeShiftMSec, pivot);
 
     endTime += timeShiftMSec;
     endTime = (endTime - pivot) * scale + pivot ;
@@ -356,22 +480,16 @@ void PointerMovement::timeShift(int time)
     startTime += time;
     endTime += time;
 
-    for (Subevent& se : subevents)
-    {
-        se.t += time;
-    }
+    subevents.shiftTimes(time);
 }
 
 
 QPointF PointerMovement::getCursorPos(int time)
 {
-    for (int i = subevents.size()-1; i >= 0; i--)
-    {
-        if (subevents[i].t <= time)
-        {
-            return QPointF(subevents[i].x, subevents[i].y);
-        }
-    }
+    if (subevents.isEmpty()) return QPointF();
+
+    // Last subevent not after the time - the first one, before the movement starts
+    return subevents.pos(qMax(subevents.upperBound(time) - 1, 0));
 }
 
 
@@ -380,8 +498,5 @@ void PenStroke::timeShift(int time)
     startTime += time;
     endTime += time;
 
-    for (Subevent& se : subevents)
-    {
-        se.t += time;
-    }
+    subevents.shiftTimes(time);
 }
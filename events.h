@@ -10,6 +10,9 @@
 
 #include "timeline.h"
 #include "strokerenderer.h"
+#include "eventregistry.h"
+#include "subeventcolumns.h"
+#include "affine2d.h"
 
 class Event
 {
@@ -18,14 +21,23 @@ public:
     static int subeventToDrawIdx;
     static QPointF cursorPos;
     static Event* activeEvent;
-    static QVector<Event*> allEvents;
+
+    // Event being dragged with the pointer tool - left out of the ink atlas and drawn over it by the canvas
+    static Event* draggedEvent;
+    static bool drawingDraggedEvent;
+
+    // Later strokes the dragged event went over - also left out of the atlas and drawn over the dragged event,
+    // in drawing order, so it doesn't show through them
+    static QVector<Event*> liftedEvents;
+    bool lifted = false;
 
     int startTime = -1, endTime = -1;
 
+    // ID is the EventRegistry handle, -1 for local events - it's also the color the event is picked by
     int type = -1, ID = -1;
 
     QRectF selectionRect;
-    QMatrix4x4 transform;
+    Affine2D transform;
 
     enum { STROKE_EVENT,
            STROKE_START,
@@ -53,6 +65,7 @@ public:
 
     virtual void mouseDragged(QPointF deltaPos) {}
 
+    // In SHRT units, before the transform
     virtual QPointF getCursorPos(int time) {return QPointF(100,100);}
 
     virtual void timeShift(int time) {}
@@ -67,14 +80,18 @@ public:
 
     virtual Event* clone() const {}
 
-    virtual ~Event() {}
+    // Leaves the registry, and the selection and drag if it was in them
+    virtual ~Event();
 
+    // The transformed selectionRect, in SHRT units - like selectionRect, its top is the highest y
     virtual QRectF getSelectionRect()
     {
-        QPointF corner1 = transform * selectionRect.topLeft();
-        QPointF corner2 = transform * selectionRect.bottomRight();
+        QRectF rect = selectionRect.normalized();
+
+        // The transform works in normalized coordinates
+        rect = transform.mapRect(QRectF(rect.topLeft() / SHRT_MAX, rect.bottomRight() / SHRT_MAX));
 
-        return QRectF(corner1, corner2);
+        return QRectF(QPointF(rect.left(), rect.bottom()) * SHRT_MAX, QPointF(rect.right(), rect.top()) * SHRT_MAX);
     }
 
     void init();
@@ -83,19 +100,19 @@ public:
 class PenStroke : public Event
 {
 public:
-    struct Subevent
-    {
-        int t,pbIdx; float x,y;
-        Subevent() {}
-        Subevent(int t, float x, float y, int pbIdx) : t(t), x(x), y(y), pbIdx(pbIdx) {}
-    };
-
     int pbStart;
     float r=0, g=0, b=0;
     float ptSize = 3;
-    QVector<Subevent> subevents;
+    SubeventColumns subevents;
     float selectionSpacing = 10.0f;
 
+    // Capsule segments in the StrokeRenderer, one per subevent - segment i joins subevent i-1 and i
+    int segStart = -1, segCount = 0;
+
+    // Transformed selectionRect padded by the stroke radius - recomputed after the stroke grows or moves
+    QRectF bounds;
+    bool boundsValid = false;
+
     ~PenStroke() {}
 
     PenStroke(int pbStart, int startT) :
@@ -107,6 +124,17 @@ public:
         b = MainWindow::si->activeColor.blueF();
 
         type = STROKE_EVENT;
+
+        StrokeRenderer::si->setSpriteStyle(r, g, b, ptSize);
+    }
+
+    // A stroke read from a file - the renderer is left alone, its sprites are regenerated once loading succeeds
+    PenStroke(int startT, float r, float g, float b, float ptSize) :
+        Event(startT, false),
+        pbStart(0),
+        r(r), g(g), b(b), ptSize(ptSize)
+    {
+        type = STROKE_EVENT;
     }
 
     virtual PenStroke* clone() const;
@@ -122,7 +150,9 @@ public:
 
     void addStrokeEvent(int t, float x, float y, int pbo)
     {
-        subevents << Subevent(t, x, y, pbo);
+        subevents.append(t, x, y, pbo);
+
+        boundsValid = false;
 
         if (subevents.size() == 1)
         {
@@ -146,20 +176,43 @@ public:
 
     void timeShift(int time);
 
-    static bool timeLessThan(const Subevent se1, const Subevent se2)
-    {
-        return se1.t < se2.t;
-    }
-
     void trimRange(int from, int to, int insertIdx, QVector<Event*> &events);
 
     void trimFrom(int from);
 
     void trimUntil(int to);
 
+    void updateSelectionRect();
+
     bool drawUntil(int time);
 
+    // What drawUntil would draw - returns whether the time is reached inside the stroke. Only reads the stroke
+    bool getDrawnUntil(int time, int &toSubevent, int &toPb) const;
+
     bool drawFromIndexUntil(int limitTime);
+
+    void ensureSegments();
+
+    void invalidateSegments()
+    {
+        segStart = -1;
+        segCount = 0;
+    }
+
+    void draw(int fromSubevent, int toSubevent, int fromPb, int toPb);
+
+    // The same, already known to be in the render target
+    void submit(int fromSubevent, int toSubevent, int fromPb, int toPb, const Affine2D &transform);
+
+    bool hitTest(QPointF pos, int time);
+
+    QRectF getBounds();
+
+    // What getBounds last worked out, without working it out again - safe to call from other threads
+    const QRectF& getCachedBounds() const
+    {
+        return bounds;
+    }
 };
 
 class EraserStroke : public PenStroke
@@ -172,6 +225,8 @@ public:
         r = 1; g = 1; b = 1;
 
         ptSize = 20;
+
+        StrokeRenderer::si->setSpriteStyle(r, g, b, ptSize);
     }
 };
 
@@ -179,14 +234,7 @@ class PointerMovement : public Event
 {
 public:
 
-    struct Subevent
-    {
-        int t; float x,y;
-        Subevent() {}
-        Subevent(int t, float x, float y) : t(t), x(x), y(y) {}
-    };
-
-    QVector<Subevent> subevents;
+    SubeventColumns subevents;
 
     ~PointerMovement() {}
 
@@ -196,7 +244,7 @@ public:
         type = POINTER_MOVEMENT_EVENT;
     }
 
-    PointerMovement(int startT, int endT, QVector<Subevent> subevents) :
+    PointerMovement(int startT, int endT, const SubeventColumns &subevents) :
         Event(startT, false)
     {
         endTime = endT;
@@ -210,12 +258,11 @@ public:
 
     virtual PointerMovement* clone() const
     {
-        return new PointerMovement(*this);
-    }
+        PointerMovement* ret = new PointerMovement(*this);
 
-    static bool timeLessThan(const Subevent se1, const Subevent se2)
-    {
-        return se1.t < se2.t;
+        ret->init();
+
+        return ret;
     }
 
     void trimRange(int from, int to, int insertIdx, QVector<Event*> &events);
@@ -232,7 +279,7 @@ public:
 
     void addPointerEvent(int t, float x, float y)
     {
-        subevents << Subevent(t, x, y);
+        subevents.append(t, x, y);
     }
 
     void closePointerEvent(int endT)
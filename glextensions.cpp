@@ -0,0 +1,102 @@
+#include "glextensions.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+GLExtensions::MultiDrawArrays GLExtensions::multiDrawArrays = NULL;
+GLExtensions::MapBufferRange GLExtensions::mapBufferRange = NULL;
+GLExtensions::UnmapBuffer GLExtensions::unmapBuffer = NULL;
+GLExtensions::FenceSync GLExtensions::fenceSync = NULL;
+GLExtensions::ClientWaitSync GLExtensions::clientWaitSync = NULL;
+GLExtensions::DeleteSync GLExtensions::deleteSync = NULL;
+GLExtensions::GetProgramBinary GLExtensions::getProgramBinary = NULL;
+GLExtensions::ProgramBinary GLExtensions::programBinary = NULL;
+GLExtensions::ProgramParameteri GLExtensions::programParameteri = NULL;
+bool GLExtensions::programBinaries = false;
+bool GLExtensions::asyncReadback = false;
+bool GLExtensions::isES = false;
+
+void* GLExtensions::getProcAddress(const char* name)
+{
+#if QT_VERSION >= 0x050000
+    return (void*) QOpenGLContext::currentContext()->getProcAddress(QByteArray(name));
+#else
+    return QGLContext::currentContext()->getProcAddress(QString(name));
+#endif
+}
+
+bool GLExtensions::hasVersion(int major, int minor)
+{
+    // "3.3.0 NVIDIA 390.87" on desktop GL, "OpenGL ES 3.0 Mesa 18.3.6" on GLES
+    const char* version = (const char*) glGetString(GL_VERSION);
+
+    if (!version) return false;
+
+    while (*version && !isdigit((unsigned char)*version)) version++;
+
+    int contextMajor = 0, contextMinor = 0;
+    sscanf(version, "%d.%d", &contextMajor, &contextMinor);
+
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+bool GLExtensions::hasExtension(const char* name)
+{
+    // NULL on core profiles, which are 3.2 or later anyway
+    const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+
+    return extensions && (QByteArray(" ") + extensions + " ").contains(QByteArray(" ") + name + " ");
+}
+
+void GLExtensions::resolve()
+{
+#if QT_VERSION >= 0x050300
+    isES = QOpenGLContext::currentContext()->isOpenGLES();
+#elif defined(QT_OPENGL_ES_2)
+    isES = true;
+#endif
+
+    // Desktop GL 1.4 or GL_EXT_multi_draw_arrays on ES
+    multiDrawArrays = (MultiDrawArrays) getProcAddress("glMultiDrawArrays");
+    if (!multiDrawArrays) multiDrawArrays = (MultiDrawArrays) getProcAddress("glMultiDrawArraysEXT");
+
+    // Desktop GL 3.0 / ARB_map_buffer_range or GL_EXT_map_buffer_range on ES
+    mapBufferRange = (MapBufferRange) getProcAddress("glMapBufferRange");
+    if (!mapBufferRange) mapBufferRange = (MapBufferRange) getProcAddress("glMapBufferRangeEXT");
+
+    unmapBuffer = (UnmapBuffer) getProcAddress("glUnmapBuffer");
+    if (!unmapBuffer) unmapBuffer = (UnmapBuffer) getProcAddress("glUnmapBufferOES");
+
+    // Only worth anything as a pair
+    if (!unmapBuffer) mapBufferRange = NULL;
+
+    // Desktop GL 3.2 / ARB_sync or GLES 3.0
+    fenceSync = (FenceSync) getProcAddress("glFenceSync");
+    clientWaitSync = (ClientWaitSync) getProcAddress("glClientWaitSync");
+    deleteSync = (DeleteSync) getProcAddress("glDeleteSync");
+
+    bool syncSupported = isES ? hasVersion(3, 0) : hasVersion(3, 2) || hasExtension("GL_ARB_sync");
+
+    asyncReadback = syncSupported && fenceSync && clientWaitSync && deleteSync && mapBufferRange;
+
+    // Desktop GL 4.1 / ARB_get_program_binary, GLES 3.0 or GL_OES_get_program_binary on GLES 2.0
+    getProgramBinary = (GetProgramBinary) getProcAddress("glGetProgramBinary");
+    if (!getProgramBinary) getProgramBinary = (GetProgramBinary) getProcAddress("glGetProgramBinaryOES");
+
+    programBinary = (ProgramBinary) getProcAddress("glProgramBinary");
+    if (!programBinary) programBinary = (ProgramBinary) getProcAddress("glProgramBinaryOES");
+
+    programParameteri = (ProgramParameteri) getProcAddress("glProgramParameteri");
+
+    // Having the entry points doesn't mean the driver can save anything
+    GLint binaryFormats = 0;
+    if (getProgramBinary && programBinary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+
+    programBinaries = binaryFormats > 0;
+
+    qDebug() << "OpenGL:" << (const char*) glGetString(GL_VERSION) << "on" << (const char*) glGetString(GL_RENDERER);
+    qDebug() << "glMultiDrawArrays:" << (multiDrawArrays ? "available" : "not available");
+    qDebug() << "glMapBufferRange:" << (mapBufferRange ? "available" : "not available");
+    qDebug() << "Asynchronous readback:" << (asyncReadback ? "available" : "not available");
+    qDebug() << "Program binaries:" << (programBinaries ? "available" : "not available");
+}
@@ -0,0 +1,97 @@
+#ifndef GLEXTENSIONS_H
+#define GLEXTENSIONS_H
+
+#include <QtCore>
+
+#if QT_VERSION >= 0x050000
+    #include <QOpenGLContext>
+#else
+    #include <QGLContext>
+#endif
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#endif
+
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_ALREADY_SIGNALED 0x911A
+#define GL_TIMEOUT_EXPIRED 0x911B
+#define GL_CONDITION_SATISFIED 0x911C
+#define GL_WAIT_FAILED 0x911D
+#endif
+
+// Entry points that are not part of QGLFunctions / QOpenGLFunctions (OpenGL ES 2.0 level).
+// They are resolved at runtime and stay NULL when the driver doesn't offer them - always check before use.
+class GLExtensions
+{
+public:
+    typedef void (APIENTRY *MultiDrawArrays)(GLenum mode, const GLint* first, const GLsizei* count, GLsizei drawcount);
+    typedef void* (APIENTRY *MapBufferRange)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+    typedef GLboolean (APIENTRY *UnmapBuffer)(GLenum target);
+
+    // GLsync is an opaque pointer - not every GL header declares it
+    typedef void* Sync;
+    typedef Sync (APIENTRY *FenceSync)(GLenum condition, GLbitfield flags);
+    typedef GLenum (APIENTRY *ClientWaitSync)(Sync sync, GLbitfield flags, quint64 timeout);
+    typedef void (APIENTRY *DeleteSync)(Sync sync);
+
+    typedef void (APIENTRY *GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+    typedef void (APIENTRY *ProgramBinary)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+    typedef void (APIENTRY *ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+
+    static MultiDrawArrays multiDrawArrays;
+    static MapBufferRange mapBufferRange;
+    static UnmapBuffer unmapBuffer;
+    static FenceSync fenceSync;
+    static ClientWaitSync clientWaitSync;
+    static DeleteSync deleteSync;
+    static GetProgramBinary getProgramBinary;
+    static ProgramBinary programBinary;
+    static ProgramParameteri programParameteri; // Only on desktop GL - GLES always lets binaries be read
+
+    // Pixel pack buffers can be read back later without stalling - desktop GL 3.2 or ARB_sync, and GLES 3.0.
+    // Decided by the context version, since drivers hand out entry points for functions the context can't run
+    static bool asyncReadback;
+
+    // Linked programs can be saved and loaded back - desktop GL 4.1, GLES 3.0 or OES_get_program_binary
+    static bool programBinaries;
+
+    // Running on OpenGL ES - no sized texture formats, no point sprite enables, GLSL ES shaders
+    static bool isES;
+
+    // Must be called with a current context
+    static void resolve();
+
+private:
+    static void* getProcAddress(const char* name);
+
+    // Of the current context, from the GL_VERSION string
+    static bool hasVersion(int major, int minor);
+    static bool hasExtension(const char* name);
+};
+
+#endif
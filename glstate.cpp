@@ -0,0 +1,177 @@
+#include "glstate.h"
+
+#include <cstring>
+
+void GLState::init()
+{
+    INIT_OPENGL_FUNCTIONS();
+
+    invalidate();
+}
+
+
+void GLState::beginFrame()
+{
+    skippedLastFrame = skippedThisFrame;
+    skippedThisFrame = 0;
+
+    // Qt may have touched the state between frames
+    invalidate();
+}
+
+
+void GLState::invalidate()
+{
+    valid = false;
+
+    for (int i = 0; i < MAX_CACHED_ATTRIBS; i++) attribPointerSet[i] = false;
+
+    uniforms.clear();
+}
+
+
+void GLState::useProgram(GLuint program)
+{
+    if (valid && this->program == program)
+    {
+        skippedThisFrame++;
+        return;
+    }
+
+    // Nothing else is known until the first program is set, so this is where the cache becomes valid
+    if (!valid)
+    {
+        arrayBuffer = 0;
+        enabledAttribs = 0;
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        for (int i = 0; i < MAX_CACHED_ATTRIBS; i++) glDisableVertexAttribArray(i);
+
+        valid = true;
+    }
+
+    glUseProgram(program);
+    this->program = program;
+}
+
+
+void GLState::bindArrayBuffer(GLuint buffer)
+{
+    if (valid && arrayBuffer == buffer)
+    {
+        skippedThisFrame++;
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    arrayBuffer = buffer;
+}
+
+
+void GLState::setEnabledAttribs(unsigned mask)
+{
+    for (int i = 0; i < MAX_CACHED_ATTRIBS; i++)
+    {
+        unsigned bit = 1 << i;
+
+        if (valid && (enabledAttribs & bit) == (mask & bit))
+        {
+            skippedThisFrame++;
+            continue;
+        }
+
+        if (mask & bit) glEnableVertexAttribArray(i);
+        else            glDisableVertexAttribArray(i);
+    }
+
+    enabledAttribs = mask;
+}
+
+
+void GLState::vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* offset)
+{
+    AttribPointer& pointer = attribPointers[index];
+
+    // The pointer refers to the buffer bound when it was set, so that's part of it too
+    if (valid && attribPointerSet[index] && pointer.buffer == arrayBuffer && pointer.size == size && pointer.type == type &&
+        pointer.normalized == normalized && pointer.stride == stride && pointer.offset == offset)
+    {
+        skippedThisFrame++;
+        return;
+    }
+
+    glVertexAttribPointer(index, size, type, normalized, stride, offset);
+
+    pointer.buffer = arrayBuffer;
+    pointer.size = size;
+    pointer.type = type;
+    pointer.normalized = normalized;
+    pointer.stride = stride;
+    pointer.offset = offset;
+    attribPointerSet[index] = true;
+}
+
+
+bool GLState::uniformChanged(int location, const float* values, int count)
+{
+    if (location < 0) return false;
+
+    quint64 key = ((quint64)program << 32) | (quint32)location;
+
+    QHash<quint64, UniformValue>::iterator it = uniforms.find(key);
+
+    if (it != uniforms.end() && it->count == count && memcmp(it->values, values, count * sizeof(float)) == 0)
+    {
+        skippedThisFrame++;
+        return false;
+    }
+
+    UniformValue value;
+    value.count = count;
+    memcpy(value.values, values, count * sizeof(float));
+
+    uniforms.insert(key, value);
+
+    return true;
+}
+
+
+void GLState::setUniform(int location, float x)
+{
+    if (uniformChanged(location, &x, 1)) glUniform1f(location, x);
+}
+
+
+void GLState::setUniform(int location, float x, float y)
+{
+    float values[] = {x, y};
+
+    if (uniformChanged(location, values, 2)) glUniform2f(location, x, y);
+}
+
+
+void GLState::setUniform(int location, float x, float y, float z)
+{
+    float values[] = {x, y, z};
+
+    if (uniformChanged(location, values, 3)) glUniform3f(location, x, y, z);
+}
+
+
+void GLState::setUniform(int location, const QMatrix4x4 &matrix)
+{
+    // Column major, as GL wants it - Qt 4 keeps qreals, which aren't always floats
+    float values[16];
+
+    for (int col = 0; col < 4; col++)
+        for (int row = 0; row < 4; row++)
+            values[col * 4 + row] = matrix(row, col);
+
+    if (uniformChanged(location, values, 16)) glUniformMatrix4fv(location, 1, GL_FALSE, values);
+}
+
+
+int GLState::getSkippedLastFrame()
+{
+    return skippedLastFrame;
+}
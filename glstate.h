@@ -0,0 +1,70 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <QHash>
+#include <QMatrix4x4>
+
+#include "shader.h"
+
+#define MAX_CACHED_ATTRIBS 4
+
+// Remembers the GL state the StrokeRenderer last set and drops the calls that wouldn't change it.
+// Everything drawn by the StrokeRenderer must go through here, or the cache has to be invalidated.
+class GLState : protected OPENGL_FUNCTIONS
+{
+    struct AttribPointer
+    {
+        GLuint buffer;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        GLsizei stride;
+        const void* offset;
+    };
+
+    struct UniformValue
+    {
+        int count;
+        float values[16];
+    };
+
+    bool valid = false;
+
+    GLuint program = 0;
+    GLuint arrayBuffer = 0;
+    unsigned enabledAttribs = 0;
+    AttribPointer attribPointers[MAX_CACHED_ATTRIBS];
+    bool attribPointerSet[MAX_CACHED_ATTRIBS];
+
+    // Keyed by program and location
+    QHash<quint64, UniformValue> uniforms;
+
+    int skippedThisFrame = 0;
+    int skippedLastFrame = 0;
+
+    bool uniformChanged(int location, const float* values, int count);
+
+public:
+    void init();
+
+    // Forget everything, so the next calls all reach GL - also rolls the skipped calls counter
+    void beginFrame();
+    void invalidate();
+
+    void useProgram(GLuint program);
+    void bindArrayBuffer(GLuint buffer);
+
+    // Bit i enables attribute i, the others are disabled
+    void setEnabledAttribs(unsigned mask);
+    void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* offset);
+
+    // Uniforms of the program in use
+    void setUniform(int location, float x);
+    void setUniform(int location, float x, float y);
+    void setUniform(int location, float x, float y, float z);
+    void setUniform(int location, const QMatrix4x4 &matrix);
+
+    int getSkippedLastFrame();
+};
+
+#endif
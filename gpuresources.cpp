@@ -0,0 +1,131 @@
+#include "gpuresources.h"
+
+#include <QSettings>
+
+#define DEFAULT_BUDGET_MB 128
+
+QHash<quint64, GpuResources::Allocation> GpuResources::allocations;
+qint64 GpuResources::ownerBytes[OWNER_COUNT];
+qint64 GpuResources::usedBytes = 0;
+qint64 GpuResources::budgetBytes = 0;
+GpuResources::Evictable* GpuResources::evictables[OWNER_COUNT];
+bool GpuResources::overBudgetReported = false;
+
+static const char* ownerNames[GpuResources::OWNER_COUNT] = { "keyframes", "picking", "ink", "sprites", "segments", "geometry", "cursor" };
+
+static quint64 keyOf(GpuResources::Kind kind, GLuint id)
+{
+    return ((quint64)kind << 32) | id;
+}
+
+static QString toMB(qint64 bytes)
+{
+    return QString::number(bytes / (1024.0 * 1024.0), 'f', 1);
+}
+
+
+void GpuResources::init()
+{
+    budgetBytes = QSettings().value("gpuMemoryBudgetMB", DEFAULT_BUDGET_MB).toInt() * (qint64)1024 * 1024;
+
+    qDebug() << "GPU memory budget:" << (budgetBytes ? toMB(budgetBytes) + " MB" : QString("unlimited"));
+}
+
+
+void GpuResources::setEvictable(Owner owner, Evictable* evictable)
+{
+    evictables[owner] = evictable;
+}
+
+
+bool GpuResources::reserve(qint64 bytes, Owner requester)
+{
+    if (budgetBytes == 0) return true;
+
+    for (int owner = 0; owner < requester && usedBytes + bytes > budgetBytes; owner++)
+    {
+        if (!evictables[owner] || ownerBytes[owner] == 0) continue;
+
+        qint64 freed = evictables[owner]->evictGpuMemory(usedBytes + bytes - budgetBytes);
+
+        if (freed > 0) qDebug() << "GPU memory: evicted" << toMB(freed) << "MB of" << ownerNames[owner] << "for" << ownerNames[requester];
+    }
+
+    if (usedBytes + bytes <= budgetBytes)
+    {
+        overBudgetReported = false;
+        return true;
+    }
+
+    if (!overBudgetReported)
+    {
+        qWarning() << "GPU memory budget exceeded by" << ownerNames[requester] << "-" << getReport();
+        overBudgetReported = true;
+    }
+
+    return false;
+}
+
+
+void GpuResources::track(Owner owner, Kind kind, GLuint id, qint64 bytes)
+{
+    untrack(kind, id);
+
+    Allocation allocation;
+    allocation.owner = owner;
+    allocation.bytes = bytes;
+
+    allocations.insert(keyOf(kind, id), allocation);
+
+    ownerBytes[owner] += bytes;
+    usedBytes += bytes;
+}
+
+
+qint64 GpuResources::untrack(Kind kind, GLuint id)
+{
+    QHash<quint64, Allocation>::iterator it = allocations.find(keyOf(kind, id));
+
+    if (it == allocations.end()) return 0;
+
+    qint64 bytes = it->bytes;
+
+    ownerBytes[it->owner] -= bytes;
+    usedBytes -= bytes;
+
+    allocations.erase(it);
+
+    return bytes;
+}
+
+
+qint64 GpuResources::getBytesUsed()
+{
+    return usedBytes;
+}
+
+
+qint64 GpuResources::getBytesUsed(Owner owner)
+{
+    return ownerBytes[owner];
+}
+
+
+qint64 GpuResources::getBudget()
+{
+    return budgetBytes;
+}
+
+
+QString GpuResources::getReport()
+{
+    QString report = toMB(usedBytes) + (budgetBytes ? " of " + toMB(budgetBytes) : QString()) + " MB (";
+
+    for (int owner = 0; owner < OWNER_COUNT; owner++)
+    {
+        if (owner > 0) report += ", ";
+        report += QString(ownerNames[owner]) + " " + toMB(ownerBytes[owner]);
+    }
+
+    return report + ")";
+}
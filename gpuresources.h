@@ -0,0 +1,71 @@
+#ifndef GPURESOURCES_H
+#define GPURESOURCES_H
+
+#include <QHash>
+#include <QVector>
+#include <QString>
+
+#include "glextensions.h"
+
+// Bookkeeping of the buffers and textures the renderer allocates, against the gpuMemoryBudgetMB setting.
+// Boards like the Pi split a small amount of memory off for the GPU, and running out of it is rarely reported -
+// things just stop being drawn. Caches register as evictable, and give memory back when an allocation wouldn't fit.
+class GpuResources
+{
+public:
+    // Ordered by how readily they are given up - reserve only evicts the owners listed before the requester
+    enum Owner { KEYFRAMES, PICKING, INK_ATLAS, SPRITES, SEGMENTS, GEOMETRY, CURSOR, OWNER_COUNT };
+
+    enum Kind { TEXTURE, BUFFER };
+
+    class Evictable
+    {
+    public:
+        // Free at least bytes if possible - returns how many were freed
+        virtual qint64 evictGpuMemory(qint64 bytes) = 0;
+    };
+
+private:
+    struct Allocation
+    {
+        Owner owner;
+        qint64 bytes;
+    };
+
+    // Keyed by kind and GL name
+    static QHash<quint64, Allocation> allocations;
+
+    static qint64 ownerBytes[OWNER_COUNT];
+    static qint64 usedBytes;
+    static qint64 budgetBytes;
+
+    static Evictable* evictables[OWNER_COUNT];
+
+    // Warn once per overrun, not on every allocation past it
+    static bool overBudgetReported;
+
+public:
+    // Read the budget - 0 means no limit
+    static void init();
+
+    static void setEvictable(Owner owner, Evictable* evictable);
+
+    // Make room for bytes more, evicting lower priority caches if needed - false if they still wouldn't fit.
+    // Resources that can't do without may be allocated anyway, the budget is then just reported as exceeded
+    static bool reserve(qint64 bytes, Owner requester);
+
+    // Record the size of a texture or buffer, replacing what was recorded for it before
+    static void track(Owner owner, Kind kind, GLuint id, qint64 bytes);
+
+    // Forget it, when it's deleted - returns its size
+    static qint64 untrack(Kind kind, GLuint id);
+
+    static qint64 getBytesUsed();
+    static qint64 getBytesUsed(Owner owner);
+    static qint64 getBudget();
+
+    // "12.3 of 64 MB (ink 6.0, keyframes 4.5, ...)"
+    static QString getReport();
+};
+
+#endif
@@ -0,0 +1,233 @@
+#include "inkatlas.h"
+#include "glextensions.h"
+
+#include <qmath.h>
+#include <QSettings>
+
+void InkAtlas::init()
+{
+    INIT_OPENGL_FUNCTIONS();
+
+    rgb565 = QSettings().value("inkFormat16Bit", false).toBool();
+}
+
+
+void InkAtlas::resize(int w, int pageH, int screenW, int screenH)
+{
+    this->w = w;
+    this->pageH = pageH;
+    this->screenW = screenW;
+    this->screenH = screenH;
+
+    // Setup tile size - as tall as the GPU allows, all of them the same
+    int maxRenderbufferSize, maxTextureSize;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbufferSize);
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+    int maxSize = qMin(maxRenderbufferSize, maxTextureSize);
+    int tileCount = (pageH + maxSize - 1) / maxSize;
+    int tileH = (pageH + tileCount - 1) / tileCount;
+
+    // Create the missing tiles, delete the extra ones
+    while (tiles.size() > tileCount)
+    {
+        GpuResources::untrack(GpuResources::TEXTURE, tiles.last().textureId);
+
+        glDeleteFramebuffers(1, &tiles.last().framebufferId);
+        glDeleteTextures(1, &tiles.last().textureId);
+        tiles.removeLast();
+    }
+    while (tiles.size() < tileCount)
+    {
+        Tile tile;
+        glGenFramebuffers(1, &tile.framebufferId);
+        glGenTextures(1, &tile.textureId);
+        tiles << tile;
+    }
+
+    for (int i = 0; i < tiles.size(); i++)
+    {
+        Tile& tile = tiles[i];
+        tile.top = i * tileH;
+        tile.height = tileH;
+
+        if (setupTile(tile)) continue;
+
+        if (rgb565)
+        {
+            qDebug("16 bit ink atlas not supported, using 24 bit.");
+
+            rgb565 = false;
+            i = -1; // Start over
+        }
+        else
+        {
+            qDebug("Ink atlas framebuffer not created.");
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    qDebug() << "Ink atlas:" << tiles.size() << "tiles of" << w << "x" << tileH << (rgb565 ? "16 bit" : "24 bit");
+
+    clear();
+}
+
+
+bool InkAtlas::setupTile(const Tile &tile)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, tile.framebufferId);
+    glBindTexture(GL_TEXTURE_2D, tile.textureId);
+
+    // Smooth the upscaling when the atlas is smaller than the screen
+    GLint filter = w < screenW ? GL_LINEAR : GL_NEAREST;
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    allocateTexture(w, tile.height);
+    GpuResources::track(GpuResources::INK_ATLAS, GpuResources::TEXTURE, tile.textureId, (qint64)w * tile.height * getBytesPerPixel());
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tile.textureId, 0);
+
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+
+void InkAtlas::allocateTexture(int width, int height)
+{
+    if (rgb565) glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
+    else        glTexImage2D(GL_TEXTURE_2D, 0, GLExtensions::isES ? GL_RGB : GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+}
+
+
+int InkAtlas::getBytesPerPixel()
+{
+    return rgb565 ? 2 : 3;
+}
+
+
+int InkAtlas::getTileCount()
+{
+    return tiles.size();
+}
+
+
+const InkAtlas::Tile& InkAtlas::getTile(int i)
+{
+    return tiles[i];
+}
+
+
+int InkAtlas::getWidth()
+{
+    return w;
+}
+
+
+int InkAtlas::getPageHeight()
+{
+    return pageH;
+}
+
+
+// Same mapping the shaders do for the screen, clip y = y * zoom - zoom + 1 + scroll, with the tile as the window
+float InkAtlas::getTileZoom(int i)
+{
+    return (float)pageH / tiles[i].height;
+}
+
+
+float InkAtlas::getTileScroll(int i)
+{
+    return 2.0f * tiles[i].top / tiles[i].height;
+}
+
+
+void InkAtlas::bindTile(int i)
+{
+    const Tile& tile = tiles[i];
+
+    glBindFramebuffer(GL_FRAMEBUFFER, tile.framebufferId);
+    glViewport(0, 0, w, tile.height);
+
+    if (scissored)
+    {
+        // Tile rows go up from its bottom
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(scissorRect.x(), tile.top + tile.height - scissorRect.y() - scissorRect.height(),
+                  scissorRect.width(), scissorRect.height());
+    }
+}
+
+
+void InkAtlas::release()
+{
+    if (scissored) glDisable(GL_SCISSOR_TEST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, screenW, screenH);
+}
+
+
+QRect InkAtlas::mapToPage(const QRectF &rect)
+{
+    int left = qFloor((rect.left() / SHRT_MAX + 1.0f) * 0.5f * w);
+    int right = qCeil((rect.right() / SHRT_MAX + 1.0f) * 0.5f * w);
+    int top = qFloor((1.0f - rect.top() / SHRT_MAX) * 0.5f * pageH);
+    int bottom = qCeil((1.0f - rect.bottom() / SHRT_MAX) * 0.5f * pageH);
+
+    return QRect(left, top, right - left, bottom - top).intersected(QRect(0, 0, w, pageH));
+}
+
+
+void InkAtlas::setScissor(const QRect &pageRect)
+{
+    scissorRect = pageRect;
+    scissored = true;
+}
+
+
+void InkAtlas::clearScissor()
+{
+    scissored = false;
+}
+
+
+void InkAtlas::clear()
+{
+    for (int i = 0; i < tiles.size(); i++)
+    {
+        bindTile(i);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    release();
+}
+
+
+void InkAtlas::drawVisible(float viewportYStart)
+{
+    // Page rows shown on screen - fractional when the atlas is scaled down
+    float screenTop = viewportYStart * pageH;
+    float visibleH = (float)screenH * w / screenW;
+
+    for (const Tile& tile : tiles)
+    {
+        float from = qMax((float)tile.top, screenTop);
+        float to = qMin((float)(tile.top + tile.height), screenTop + visibleH);
+
+        if (to <= from) continue;
+
+        // Texture rows go up from the bottom of the tile
+        glBindTexture(GL_TEXTURE_2D, tile.textureId);
+        StrokeRenderer::si->drawTexturedRect(-1.0f, 1.0f - 2.0f * (from - screenTop) / visibleH,
+                                             2.0f, -2.0f * (to - from) / visibleH,
+                                             1.0f - (from - tile.top) / tile.height,
+                                             1.0f - (to - tile.top) / tile.height);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
@@ -0,0 +1,74 @@
+#ifndef INKATLAS_H
+#define INKATLAS_H
+
+#include <QVector>
+#include <QRect>
+
+#include "strokerenderer.h"
+
+// The whole page of ink, canvasRatio times as tall as it is wide, kept in textures between frames.
+// Strokes are drawn into it and the screen shows the part under the scrollbar, so scrolling needs no redraw.
+// It is split in horizontal tiles when the page is taller than the largest framebuffer the GPU can make.
+// Its resolution may be lower than the screen's, to save fill rate - the blit then scales it up.
+class InkAtlas : protected OPENGL_FUNCTIONS
+{
+public:
+    struct Tile
+    {
+        GLuint framebufferId, textureId;
+        int top, height; // In page pixels, from the top of the page
+    };
+
+private:
+    QVector<Tile> tiles;
+
+    int w = 0, pageH = 0, screenW = 0, screenH = 0;
+
+    // 16 bit color halves the fill and memory cost - dropped if the driver can't render to it
+    bool rgb565 = false;
+
+    bool setupTile(const Tile &tile);
+
+    // Drawing into the tiles is limited to this page rect while scissored
+    QRect scissorRect;
+    bool scissored = false;
+
+public:
+    void init();
+
+    // w and pageH are the size of the page in atlas pixels, screenW and screenH the size of the window
+    void resize(int w, int pageH, int screenW, int screenH);
+
+    // Allocate the bound texture with the atlas color format
+    void allocateTexture(int width, int height);
+    int getBytesPerPixel();
+
+    int getTileCount();
+    const Tile& getTile(int i);
+    int getWidth();
+    int getPageHeight();
+
+    // Zoom and scroll the stroke shaders need to draw into tile i
+    float getTileZoom(int i);
+    float getTileScroll(int i);
+
+    // Bind tile i framebuffer and viewport
+    void bindTile(int i);
+
+    // Back to the screen framebuffer and viewport
+    void release();
+
+    void clear();
+
+    // Page pixels covered by a rect in SHRT units, top being its highest y
+    QRect mapToPage(const QRectF &rect);
+
+    // Limit clearing and drawing to a part of the page, until clearScissor()
+    void setScissor(const QRect &pageRect);
+    void clearScissor();
+
+    // Blit the visible part of the page to the bound framebuffer
+    void drawVisible(float viewportYStart);
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include "keyframecache.h"
+#include "canvas.h"
+
+#define DEFAULT_KEYFRAME_PAGES 4 // Pool size when keyframeMemoryMB isn't set - a keyframe is a copy of the whole page
+#define DEFAULT_EVENT_INTERVAL 50
+#define DEFAULT_TIME_INTERVAL 30000
+
+void KeyframeCache::init()
+{
+    INIT_OPENGL_FUNCTIONS();
+
+    eventInterval = QSettings().value("keyframeEventInterval", DEFAULT_EVENT_INTERVAL).toInt();
+    timeInterval = QSettings().value("keyframeTimeInterval", DEFAULT_TIME_INTERVAL).toInt();
+
+    GpuResources::setEvictable(GpuResources::KEYFRAMES, this);
+}
+
+
+void KeyframeCache::resize()
+{
+    invalidateAll();
+
+    for (const QVector<GLuint>& textureIds : freeTextures) deleteTextures(textureIds);
+    freeTextures.clear();
+
+    w = Canvas::si->atlas.getWidth();
+    h = Canvas::si->atlas.getPageHeight();
+
+    // Setup pool size - keyframeMemoryMB can be lowered for boards with little video memory, like the Pi.
+    // There is always room for one, the GPU memory budget evicts it if it must
+    qint64 pageBytes = qMax((qint64)w * h * Canvas::si->atlas.getBytesPerPixel(), (qint64)1);
+    qint64 budget = QSettings().value("keyframeMemoryMB", 0).toInt() * (qint64)1024 * 1024;
+
+    maxKeyframes = budget > 0 ? qMax(budget / pageBytes, (qint64)1) : DEFAULT_KEYFRAME_PAGES;
+
+    qDebug() << "Keyframe cache:" << maxKeyframes << "keyframes of" << w << "x" << h;
+}
+
+
+void KeyframeCache::invalidateAll()
+{
+    for (const Keyframe& keyframe : keyframes) freeTextures << keyframe.textureIds;
+    keyframes.clear();
+
+    eventInterval = QSettings().value("keyframeEventInterval", DEFAULT_EVENT_INTERVAL).toInt();
+    timeInterval = QSettings().value("keyframeTimeInterval", DEFAULT_TIME_INTERVAL).toInt();
+}
+
+
+void KeyframeCache::invalidateFrom(int eventIdx)
+{
+    while (!keyframes.isEmpty() && keyframes.last().eventIdx > eventIdx)
+    {
+        freeTextures << keyframes.last().textureIds;
+        keyframes.removeLast();
+    }
+}
+
+
+int KeyframeCache::restore(int time, int &doneTime)
+{
+    int i = keyframes.size() - 1;
+
+    while (i >= 0 && keyframes[i].doneTime > time) i--;
+
+    if (i < 0)
+    {
+        doneTime = 0;
+        return 0;
+    }
+
+    // Overwrite the atlas with the keyframe - no blending, so it's an exact copy
+    InkAtlas& atlas = Canvas::si->atlas;
+
+    glDisable(GL_BLEND);
+
+    for (int t = 0; t < atlas.getTileCount(); t++)
+    {
+        atlas.bindTile(t);
+
+        glBindTexture(GL_TEXTURE_2D, keyframes[i].textureIds[t]);
+        StrokeRenderer::si->drawTexturedRect(-1.0, 1.0, 2.0, -2.0);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    atlas.release();
+
+    glEnable(GL_BLEND);
+
+    doneTime = keyframes[i].doneTime;
+    return keyframes[i].eventIdx;
+}
+
+
+bool KeyframeCache::wants(int eventIdx, int doneTime)
+{
+    if (maxKeyframes == 0) return false;
+
+    int lastIdx = 0, lastTime = 0;
+
+    for (const Keyframe& keyframe : keyframes)
+    {
+        if (keyframe.eventIdx == eventIdx) return false;
+        if (keyframe.eventIdx > eventIdx) break;
+
+        lastIdx = keyframe.eventIdx;
+        lastTime = keyframe.doneTime;
+    }
+
+    return eventIdx - lastIdx >= eventInterval || doneTime - lastTime >= timeInterval;
+}
+
+
+QVector<GLuint> KeyframeCache::takeTextures()
+{
+    if (!freeTextures.isEmpty()) return freeTextures.takeLast();
+
+    InkAtlas& atlas = Canvas::si->atlas;
+    QVector<GLuint> textureIds(atlas.getTileCount());
+
+    if (!GpuResources::reserve((qint64)w * h * atlas.getBytesPerPixel(), GpuResources::KEYFRAMES)) return QVector<GLuint>();
+
+    glGenTextures(textureIds.size(), textureIds.data());
+
+    for (int t = 0; t < textureIds.size(); t++)
+    {
+        glBindTexture(GL_TEXTURE_2D, textureIds[t]);
+
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        atlas.allocateTexture(w, atlas.getTile(t).height);
+        GpuResources::track(GpuResources::KEYFRAMES, GpuResources::TEXTURE, textureIds[t], (qint64)w * atlas.getTile(t).height * atlas.getBytesPerPixel());
+    }
+
+    return textureIds;
+}
+
+
+qint64 KeyframeCache::deleteTextures(const QVector<GLuint> &textureIds)
+{
+    qint64 bytes = 0;
+
+    for (GLuint textureId : textureIds) bytes += GpuResources::untrack(GpuResources::TEXTURE, textureId);
+
+    glDeleteTextures(textureIds.size(), textureIds.constData());
+
+    return bytes;
+}
+
+
+qint64 KeyframeCache::evictGpuMemory(qint64 bytes)
+{
+    qint64 freed = 0;
+
+    while (freed < bytes && !freeTextures.isEmpty()) freed += deleteTextures(freeTextures.takeLast());
+
+    // Every other keyframe, the latest last - unlike a full pool, the ink may need the very last one's memory
+    while (freed < bytes && !keyframes.isEmpty())
+    {
+        for (int i = keyframes.size() - 2; i >= 0; i -= 2)
+        {
+            freed += deleteTextures(keyframes[i].textureIds);
+            keyframes.remove(i);
+        }
+
+        if (freed < bytes && keyframes.size() == 1)
+        {
+            freed += deleteTextures(keyframes.last().textureIds);
+            keyframes.removeLast();
+        }
+
+        eventInterval *= 2;
+        timeInterval *= 2;
+    }
+
+    return freed;
+}
+
+
+void KeyframeCache::capture(int eventIdx, int doneTime)
+{
+    // When the pool is full, keep every other keyframe and space the next ones twice as much. The latest one
+    // stays, so there is always a keyframe left
+    if (keyframes.size() >= maxKeyframes)
+    {
+        for (int i = keyframes.size() - 2; i >= 0; i -= 2)
+        {
+            freeTextures << keyframes[i].textureIds;
+            keyframes.remove(i);
+        }
+
+        eventInterval *= 2;
+        timeInterval *= 2;
+
+        if (!wants(eventIdx, doneTime)) return;
+
+        // A pool of one moves its keyframe on
+        if (keyframes.size() >= maxKeyframes)
+        {
+            freeTextures << keyframes.last().textureIds;
+            keyframes.removeLast();
+        }
+    }
+
+    Keyframe keyframe;
+    keyframe.eventIdx = eventIdx;
+    keyframe.doneTime = doneTime;
+    keyframe.textureIds = takeTextures();
+
+    if (keyframe.textureIds.isEmpty()) return;
+
+    InkAtlas& atlas = Canvas::si->atlas;
+
+    for (int t = 0; t < atlas.getTileCount(); t++)
+    {
+        atlas.bindTile(t);
+
+        glBindTexture(GL_TEXTURE_2D, keyframe.textureIds[t]);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, w, atlas.getTile(t).height);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    atlas.release();
+
+    int i = keyframes.size();
+    while (i > 0 && keyframes[i-1].eventIdx > eventIdx) i--;
+
+    keyframes.insert(i, keyframe);
+}
+
+
+int KeyframeCache::getKeyframeCount()
+{
+    return keyframes.size();
+}
+
+
+int KeyframeCache::getBytesUsed()
+{
+    return (keyframes.size() + freeTextures.size()) * w * h * Canvas::si->atlas.getBytesPerPixel();
+}
@@ -0,0 +1,59 @@
+#ifndef KEYFRAMECACHE_H
+#define KEYFRAMECACHE_H
+
+#include <QVector>
+
+#include "strokerenderer.h"
+
+// Snapshots of the ink atlas taken while redrawing, so seeking doesn't replay the lecture from t=0.
+// Keyframe k holds events [0, k) fully drawn, and can be used for any time after all of them ended.
+class KeyframeCache : protected OPENGL_FUNCTIONS, public GpuResources::Evictable
+{
+    struct Keyframe
+    {
+        int eventIdx, doneTime;
+        QVector<GLuint> textureIds; // One per atlas tile
+    };
+
+    QVector<Keyframe> keyframes; // Sorted by eventIdx
+    QVector<QVector<GLuint> > freeTextures;
+
+    int w = 0, h = 0;
+    int maxKeyframes = 0;
+
+    // Distance between keyframes - doubled every time the pool fills up
+    int eventInterval, timeInterval;
+
+    // Empty if they don't fit the GPU memory budget
+    QVector<GLuint> takeTextures();
+
+    // Returns the bytes freed
+    qint64 deleteTextures(const QVector<GLuint> &textureIds);
+
+public:
+    void init();
+
+    // Reallocate for the current atlas size - every keyframe is lost
+    void resize();
+
+    void invalidateAll();
+
+    // Drop the keyframes that include the event at eventIdx
+    void invalidateFrom(int eventIdx);
+
+    // Draw the latest usable keyframe into the atlas - returns the first event left to draw
+    int restore(int time, int &doneTime);
+
+    bool wants(int eventIdx, int doneTime);
+
+    // Copy the atlas, holding events [0, eventIdx)
+    void capture(int eventIdx, int doneTime);
+
+    int getKeyframeCount();
+    int getBytesUsed();
+
+    // The spare textures go first, then every other keyframe as when the pool fills up, then the last one
+    qint64 evictGpuMemory(qint64 bytes);
+};
+
+#endif
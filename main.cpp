@@ -1,12 +1,38 @@
 #include "mainwindow.h"
+#include "startuptimer.h"
 #include <QDesktopWidget>
 #include <QApplication>
 #include <QSettings>
 #include <QStyleFactory>
 #include <QFont>
 
+#if QT_VERSION >= 0x050400
+    #include <QSurfaceFormat>
+#endif
+
 int main(int argc, char *argv[])
 {
+    StartupTimer::start();
+
+    // --gles renders with OpenGL ES 2.0 on an EGL surface, as on the Raspberry Pi - Mesa provides both on desktop Linux
+    for (int i = 1; i < argc; i++)
+    {
+        if (QString(argv[i]) != "--gles") continue;
+
+#if QT_VERSION >= 0x050400
+        qputenv("QT_XCB_GL_INTEGRATION", "xcb_egl");
+
+        QCoreApplication::setAttribute(Qt::AA_UseOpenGLES);
+
+        QSurfaceFormat format;
+        format.setRenderableType(QSurfaceFormat::OpenGLES);
+        format.setVersion(2, 0);
+        QSurfaceFormat::setDefaultFormat(format);
+#else
+        qWarning("--gles needs Qt 5.4 - build Qt with -opengl es2 instead");
+#endif
+    }
+
     QApplication app(argc, argv);
 
     QApplication::setStyle(QStyleFactory::create("fusion"));
@@ -15,9 +41,16 @@ int main(int argc, char *argv[])
     QCoreApplication::setOrganizationDomain("LiberaAkademio.com");
     QCoreApplication::setApplicationName("LiberaAkademioEditor");
 
+    StartupTimer::mark("application created");
+
     MainWindow window;
     window.move(QApplication::desktop()->screen()->rect().center() - window.rect().center());
+
+    StartupTimer::mark("main window created");
+
     window.show();
 
+    StartupTimer::mark("main window shown");
+
     return app.exec();
 }
@@ -67,6 +67,10 @@ MainWindow::MainWindow(QWidget *parent) :
         cb->setStyleSheet(cbStyleSheets.back());
     }
 
+    // They need the audio format and devices, probed in the background - see Timeline::audioDevicesProbed
+    ui->recButton->setDisabled(true);
+    ui->playPauseButton->setDisabled(true);
+    ui->openButton->setDisabled(true);
 }
 
 
@@ -139,6 +143,13 @@ void MainWindow::on_playPauseButton_clicked(bool checked)
     }
 }
 
+void MainWindow::enableAudioButtons()
+{
+    ui->recButton->setDisabled(false);
+    ui->playPauseButton->setDisabled(false);
+    ui->openButton->setDisabled(false);
+}
+
 void MainWindow::stopPlaying()
 {
     ui->playPauseButton->setIcon(QIcon(":/icons/icons/icon-play.png"));
@@ -310,18 +321,16 @@ void MainWindow::on_canvasScrollBar_valueChanged(int value)
 
 void MainWindow::on_openButton_clicked()
 {
-    childWindowOpen = true;
     QString file = QFileDialog::getOpenFileName( this,tr("Select project to open"),
                                                 QDir::homePath(), tr("LA-video (*.vvf)") );
-    childWindowOpen = false;
+
+    if (!file.isEmpty()) Timeline::si->loadVideo(file);
 }
 
 void MainWindow::on_saveButton_clicked()
 {
-    childWindowOpen = true;
     QString file = QFileDialog::getSaveFileName( this,tr("Save project as"),
                                                 QDir::homePath() + "/untitled.vvf", tr("LA-video (*.vvf)") );
-    childWindowOpen = false;
 }
 
 
@@ -388,54 +397,36 @@ void MainWindow::keyPressEvent(QKeyEvent *event)
 
 void MainWindow::on_optionsButton_clicked()
 {
-    childWindowOpen = true;
-
     optionsWindow = new Options(0);
 
     optionsWindow->exec();
-
-    childWindowOpen = false;
 }
 
 void MainWindow::on_newButton_clicked()
 {
-    childWindowOpen = true;
-
     newProject = new NewProject(0);
 
     newProject->exec();
-
-    childWindowOpen = false;
 }
 
 void MainWindow::on_uploadButton_clicked()
 {
-    childWindowOpen = true;
-
     upload = new Upload(0);
 
     upload->exec();
-
-    childWindowOpen = false;
 }
 
 void MainWindow::on_hotkeysButton_clicked()
 {
-    childWindowOpen = true;
-
     hotkeys = new Hotkeys(0);
 
     hotkeys->exec();
-
-    childWindowOpen = false;
 }
 
 void MainWindow::on_exportButton_clicked()
 {
-    childWindowOpen = true;
     QString file = QFileDialog::getSaveFileName( this,tr("Export video to"),
                                                 QDir::homePath() + "/untitled", tr("Portable Network Graphics (*.png);; Joint Photographic Experts Group (*.jpg);; MPEG-4 (.mp4)") );
-    childWindowOpen = false;
 }
 
 
@@ -37,10 +37,11 @@ public:
     enum {PEN_TOOL, ERASER_TOOL, IMAGE_TOOL, LINE_TOOL, TEXT_TOOL, POINTER_TOOL};
     int activeTool = PEN_TOOL;
 
-    bool childWindowOpen = false;
-
     void stopPlaying();
 
+    // Recording, playing and opening lectures are enabled once the audio devices are probed
+    void enableAudioButtons();
+
     QSettings* settings;
 
 private slots:
@@ -3,6 +3,7 @@
 #include "timeline.h"
 
 #include "mainwindow.h"
+#include "strokerenderer.h"
 
 Options* Options::si;
 
@@ -77,6 +78,19 @@ Options::Options(QWidget *parent) :
     {
         pb->setValue(0);
     }
+
+    // Load rendering mode
+    if (QSettings().value("renderingMode", StrokeRenderer::QUAD_RENDERING).toInt() == StrokeRenderer::SPRITE_RENDERING)
+    {
+        ui->spritesRenderingButton->setChecked(true);
+    }
+    else
+    {
+        ui->quadsRenderingButton->setChecked(true);
+    }
+
+    // Show what the renderer holds on the GPU
+    ui->gpuMemoryLabel->setText("GPU memory: " + GpuResources::getReport());
 }
 
 Options::~Options()
@@ -96,6 +110,12 @@ void Options::on_audioOutputComboBox_activated(const QString &arg1)
 
 void Options::on_pushButton_clicked()
 {
+    if (!Timeline::si->audioInput)
+    {
+        qWarning() << "Audio devices are still being probed";
+        return;
+    }
+
     // Create and open audio file
     #ifndef Q_OS_MAC
     noise = new QFile("noise.wav");
@@ -112,6 +132,22 @@ void Options::on_pushButton_clicked()
     st.start();
 }
 
+void Options::on_spritesRenderingButton_toggled(bool checked)
+{
+    if (!checked) return;
+
+    QSettings().setValue("renderingMode", StrokeRenderer::SPRITE_RENDERING);
+    StrokeRenderer::si->setRenderingMode(StrokeRenderer::SPRITE_RENDERING);
+}
+
+void Options::on_quadsRenderingButton_toggled(bool checked)
+{
+    if (!checked) return;
+
+    QSettings().setValue("renderingMode", StrokeRenderer::QUAD_RENDERING);
+    StrokeRenderer::si->setRenderingMode(StrokeRenderer::QUAD_RENDERING);
+}
+
 
 void StoperThread::run()
 {
@@ -39,6 +39,10 @@ private slots:
 
     void on_pushButton_clicked();
 
+    void on_spritesRenderingButton_toggled(bool checked);
+
+    void on_quadsRenderingButton_toggled(bool checked);
+
 private:
     Ui::Options *ui;
 
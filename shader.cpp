@@ -1,7 +1,74 @@
 #include "shader.h"
-#include "configs.h"
+#include "glextensions.h"
 
 #include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDataStream>
+#include <QSettings>
+#include <QCryptographicHash>
+
+#if QT_VERSION >= 0x050000
+    #include <QStandardPaths>
+#else
+    #include <QDesktopServices>
+#endif
+
+// Desktop GLSL 1.20 as written, or its GLSL ES 1.00 variant - without the #version line, and with a default
+// float precision for fragment shaders, as GLES has none. Desktop Qt defines highp and friends away by itself.
+static QByteArray loadShaderSource(const QString &filename, bool fragment)
+{
+    QFile file(filename);
+    file.open(QIODevice::ReadOnly);
+
+    QByteArray source = file.readAll();
+
+    if (!GLExtensions::isES) return source;
+
+    int version = source.indexOf("#version");
+    if (version >= 0) source.remove(version, source.indexOf('\n', version) - version);
+
+    QByteArray header = "#version 100\n";
+
+    if (fragment)
+    {
+        header += "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+                  "precision highp float;\n"
+                  "#else\n"
+                  "precision mediump float;\n"
+                  "#define highp mediump\n"
+                  "#endif\n";
+    }
+
+    return header + source;
+}
+
+
+static QString programCacheFolder()
+{
+#if QT_VERSION >= 0x050000
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/shaders/";
+#else
+    return QDesktopServices::storageLocation(QDesktopServices::CacheLocation) + "/shaders/";
+#endif
+}
+
+
+// A binary is only good for the driver that made it, from the very same sources and attribute bindings
+static QString programCacheKey(const QByteArray &vertexSource, const QByteArray &fragmentSource, const QVector<QString> &attributes)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    hash.addData((const char*) glGetString(GL_VENDOR));
+    hash.addData((const char*) glGetString(GL_RENDERER));
+    hash.addData((const char*) glGetString(GL_VERSION));
+    hash.addData(vertexSource);
+    hash.addData(fragmentSource);
+
+    for (const QString& attribute : attributes) hash.addData(attribute.toUtf8());
+
+    return hash.result().toHex();
+}
 
 Shader::Shader(QString shader, QVector<QString> attributes)
 {
@@ -15,33 +82,47 @@ Shader::Shader()
 
 void Shader::init(QString shader, QVector<QString> attributes)
 {
-    QString vertexShaderFilename(EXEC_FOLDER + "shaders/" + shader + ".vsh");
-    QString fragmentShaderFilename(EXEC_FOLDER + "shaders/" + shader + ".fsh");
+    INIT_OPENGL_FUNCTIONS();
+
+    // Built into the executable - see resources.qrc
+    QString vertexShaderFilename(":/shaders/shaders/" + shader + ".vsh");
+    QString fragmentShaderFilename(":/shaders/shaders/" + shader + ".fsh");
+
+    QByteArray vertexSource, fragmentSource;
 
-//    // load and compile vertex shader
     QFileInfo vsh(vertexShaderFilename);
-    if(vsh.exists())
-    {
-        SHADER* vertexShader = new SHADER(SHADER::Vertex);
-        if(vertexShader->compileSourceFile(vertexShaderFilename))
-            shaderProgram.addShader(vertexShader);
-        else qWarning() << "Vertex Shader Error" << vertexShader->log();
-    }
+    if(vsh.exists()) vertexSource = loadShaderSource(vertexShaderFilename, false);
     else qWarning() << "Vertex Shader source file " << vertexShaderFilename << " not found.";
 
-    //load and compile fragment shader
     QFileInfo fsh(fragmentShaderFilename);
-    if(fsh.exists())
-    {
-        SHADER* fragmentShader = new SHADER(SHADER::Fragment);
-        if(fragmentShader->compileSourceFile(fragmentShaderFilename))
-            shaderProgram.addShader(fragmentShader);
-        else qWarning() << "Fragment Shader Error" << fragmentShader->log();
-    }
+    if(fsh.exists()) fragmentSource = loadShaderSource(fragmentShaderFilename, true);
     else qWarning() << "Fragment Shader source file " << fragmentShaderFilename << " not found.";
 
     pId = shaderProgram.programId();
 
+    // Skip compiling and linking if an earlier run saved this program
+    bool useCache = GLExtensions::programBinaries && QSettings().value("shaderCache", true).toBool();
+    QString cacheKey;
+
+    if (useCache)
+    {
+        cacheKey = programCacheKey(vertexSource, fragmentSource, attributes);
+
+        if (loadProgramBinary(cacheKey)) return;
+    }
+
+    // load and compile vertex shader
+    SHADER* vertexShader = new SHADER(SHADER::Vertex);
+    if(vertexShader->compileSourceCode(vertexSource))
+        shaderProgram.addShader(vertexShader);
+    else qWarning() << "Vertex Shader Error" << vertexShader->log();
+
+    //load and compile fragment shader
+    SHADER* fragmentShader = new SHADER(SHADER::Fragment);
+    if(fragmentShader->compileSourceCode(fragmentSource))
+        shaderProgram.addShader(fragmentShader);
+    else qWarning() << "Fragment Shader Error" << fragmentShader->log();
+
     shaderProgram.bindAttributeLocation("vertexPos", 0);
 
     for (int i = 0; i < attributes.size(); i++)
@@ -49,10 +130,70 @@ void Shader::init(QString shader, QVector<QString> attributes)
         shaderProgram.bindAttributeLocation(attributes[i], i+1);
     }
 
+    if (useCache && GLExtensions::programParameteri)
+    {
+        GLExtensions::programParameteri(pId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
     if(!shaderProgram.link())
     {
         qWarning() << "Shader Program Linker Error" << shaderProgram.log();
     }
+    else if (useCache)
+    {
+        saveProgramBinary(cacheKey);
+    }
+}
+
+
+bool Shader::loadProgramBinary(const QString &key)
+{
+    QFile file(programCacheFolder() + key);
+
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    quint32 format;
+    QByteArray binary;
+
+    QDataStream in(&file);
+    in >> format >> binary;
+
+    file.close();
+
+    GLExtensions::programBinary(pId, format, binary.constData(), binary.size());
+
+    // With no shaders added, link() only checks whether the program is already linked - a binary the driver
+    // turns down leaves it unlinked, and then the sources are compiled as usual
+    if (in.status() == QDataStream::Ok && shaderProgram.link()) return true;
+
+    qDebug() << "Program binary" << key << "rejected, compiling from source";
+
+    file.remove();
+
+    return false;
+}
+
+
+void Shader::saveProgramBinary(const QString &key)
+{
+    GLint length = 0;
+    glGetProgramiv(pId, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0) return;
+
+    QByteArray binary(length, 0);
+    GLenum format;
+
+    GLExtensions::getProgramBinary(pId, length, &length, &format, binary.data());
+
+    QDir().mkpath(programCacheFolder());
+
+    QFile file(programCacheFolder() + key);
+
+    if (!file.open(QIODevice::WriteOnly)) return;
+
+    QDataStream out(&file);
+    out << (quint32)format << binary.left(length);
 }
 
 void printGlError()
@@ -5,17 +5,23 @@
 
 #if QT_VERSION >= 0x050000
     #include <QOpenGLShaderProgram>
+    #include <QOpenGLFunctions>
     #define SHADER_PROGRAM QOpenGLShaderProgram
     #define SHADER QOpenGLShader
+    #define INIT_OPENGL_FUNCTIONS initializeOpenGLFunctions
+    #define OPENGL_FUNCTIONS QOpenGLFunctions
 #else
     #include <QGLShaderProgram>
     #include <QGLShader>
+    #include <QGLFunctions>
     #define SHADER_PROGRAM QGLShaderProgram
     #define SHADER QGLShader
+    #define INIT_OPENGL_FUNCTIONS initializeGLFunctions
+    #define OPENGL_FUNCTIONS QGLFunctions
 #endif
 
 
-class Shader
+class Shader : protected OPENGL_FUNCTIONS
 {
 public:
     Shader();
@@ -29,6 +35,9 @@ public:
     Shader(QString vshader, QVector<QString> attributes);
 private:
 
+    // Linked programs saved by earlier runs, by driver and sources - see programCacheKey()
+    bool loadProgramBinary(const QString &key);
+    void saveProgramBinary(const QString &key);
 };
 
 #endif
@@ -0,0 +1,149 @@
+#include "spatialindex.h"
+#include "events.h"
+
+#include <QSet>
+#include <QtAlgorithms>
+
+#define GRID_SIZE 64
+#define CELL_SIZE (65536 / GRID_SIZE)
+
+// In timeline.cpp
+bool startTimeLessThan(const Event* e1, const Event* e2);
+
+SpatialIndex::SpatialIndex()
+{
+    cells.resize(GRID_SIZE * GRID_SIZE);
+}
+
+
+int SpatialIndex::toCell(float value)
+{
+    return qBound(0, (int)((value + 32768.0f) / CELL_SIZE), GRID_SIZE - 1);
+}
+
+
+QRect SpatialIndex::cellRange(Event* ev)
+{
+    QRectF rect = ((PenStroke*)ev)->getBounds();
+
+    return QRect(QPoint(toCell(rect.left()), toCell(rect.bottom())),
+                 QPoint(toCell(rect.right()), toCell(rect.top())));
+}
+
+
+void SpatialIndex::update(Event* ev)
+{
+    // Without a handle (the registry was full) it can't be found again
+    if (ev == NULL || ev->type != Event::STROKE_EVENT || ev->ID < 0) return;
+
+    QRect range = cellRange(ev);
+
+    if (eventCells.contains(ev->ID))
+    {
+        if (eventCells.value(ev->ID) == range) return;
+
+        remove(ev);
+    }
+
+    for (int y = range.top(); y <= range.bottom(); y++)
+    {
+        for (int x = range.left(); x <= range.right(); x++)
+        {
+            cells[y * GRID_SIZE + x] << ev->ID;
+        }
+    }
+
+    eventCells.insert(ev->ID, range);
+}
+
+
+void SpatialIndex::remove(Event* ev)
+{
+    if (!eventCells.contains(ev->ID)) return;
+
+    QRect range = eventCells.value(ev->ID);
+
+    for (int y = range.top(); y <= range.bottom(); y++)
+    {
+        for (int x = range.left(); x <= range.right(); x++)
+        {
+            QVector<int>& cell = cells[y * GRID_SIZE + x];
+
+            int i = cell.indexOf(ev->ID);
+            if (i >= 0) cell.remove(i);
+        }
+    }
+
+    eventCells.remove(ev->ID);
+}
+
+
+void SpatialIndex::rebuild(const QVector<Event*> &events)
+{
+    for (QVector<int>& cell : cells) cell.resize(0);
+    eventCells.clear();
+
+    for (Event* ev : events) update(ev);
+}
+
+
+int SpatialIndex::pick(QPointF pos, int time)
+{
+    int bestID = -1, bestStart = -1;
+
+    for (int ID : cells[toCell(pos.y()) * GRID_SIZE + toCell(pos.x())])
+    {
+        PenStroke* stroke = (PenStroke*)EventRegistry::get(ID);
+
+        // Deleted since the index was built
+        if (!stroke) continue;
+
+        // Later events are drawn on top - skip those that couldn't cover the current best
+        if (stroke->startTime > time) continue;
+        if (stroke->startTime < bestStart || (stroke->startTime == bestStart && ID < bestID)) continue;
+
+        if (stroke->hitTest(pos, time))
+        {
+            bestID = ID;
+            bestStart = stroke->startTime;
+        }
+    }
+
+    return bestID;
+}
+
+
+QVector<Event*> SpatialIndex::query(const QRectF &rect)
+{
+    QVector<Event*> found;
+    QSet<int> seen;
+
+    for (int y = toCell(rect.bottom()); y <= toCell(rect.top()); y++)
+    {
+        for (int x = toCell(rect.left()); x <= toCell(rect.right()); x++)
+        {
+            for (int ID : cells[y * GRID_SIZE + x])
+            {
+                if (seen.contains(ID)) continue;
+                seen.insert(ID);
+
+                PenStroke* stroke = (PenStroke*)EventRegistry::get(ID);
+
+                if (!stroke) continue;
+
+                QRectF bounds = stroke->getBounds();
+
+                if (bounds.left() <= rect.right() && bounds.right() >= rect.left() &&
+                    bounds.bottom() <= rect.top() && bounds.top() >= rect.bottom())
+                {
+                    found << stroke;
+                }
+            }
+        }
+    }
+
+    // The timeline keeps events sorted by start time, so that's the order they are drawn in
+    qStableSort(found.begin(), found.end(), startTimeLessThan);
+
+    return found;
+}
@@ -0,0 +1,42 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QVector>
+#include <QHash>
+#include <QRect>
+#include <QRectF>
+#include <QPointF>
+
+class Event;
+
+// Uniform grid over the canvas, in SHRT units, holding the IDs of the strokes whose padded bounding box
+// touches each cell. Picking looks at a single cell and then tests the strokes' segments on the CPU.
+class SpatialIndex
+{
+    QVector< QVector<int> > cells;
+
+    // Cells covered by each indexed event, by ID
+    QHash<int, QRect> eventCells;
+
+    static int toCell(float value);
+
+    QRect cellRange(Event* ev);
+
+public:
+    SpatialIndex();
+
+    // Add the event or refresh it after it grew or moved - only strokes are indexed
+    void update(Event* ev);
+
+    void remove(Event* ev);
+
+    void rebuild(const QVector<Event*> &events);
+
+    // ID of the topmost stroke drawn at pos by the given time, or -1
+    int pick(QPointF pos, int time);
+
+    // Strokes whose padded bounding box overlaps rect (SHRT units, top being its highest y), in drawing order
+    QVector<Event*> query(const QRectF &rect);
+};
+
+#endif
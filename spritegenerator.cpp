@@ -0,0 +1,200 @@
+#include "spritegenerator.h"
+#include "events.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+#include <cstring>
+#include <qmath.h>
+
+#define MIN_STROKES_PER_THREAD 64
+
+// Runs one of the two passes over a slice of the strokes
+class SpriteGeneratorTask : public QRunnable
+{
+public:
+    enum Pass { GENERATE, PLACE };
+
+private:
+    SpriteGenerator* generator;
+    PenStroke* const* strokes;
+    int first, count;
+    Pass pass;
+
+    const int* offsets;
+    StrokeSprite* sprites;
+
+public:
+    SpriteGeneratorTask(SpriteGenerator* generator, PenStroke* const* strokes, int first, int count, Pass pass,
+                        const int* offsets = NULL, StrokeSprite* sprites = NULL) :
+        generator(generator), strokes(strokes), first(first), count(count), pass(pass), offsets(offsets), sprites(sprites) {}
+
+    void run()
+    {
+        for (int i = first; i < first + count; i++)
+        {
+            // Every thread only touches the strokes of its slice
+            QVector<StrokeSprite>& strokeSprites = generator->strokeSpritesData[i];
+
+            if (pass == GENERATE)
+            {
+                generator->generateStroke(strokes[i], strokeSprites);
+                continue;
+            }
+
+            // Move the stroke's sprites and indexes from 0 to its offset
+            if (!strokeSprites.isEmpty()) memcpy(sprites + offsets[i], strokeSprites.constData(), strokeSprites.size() * sizeof(StrokeSprite));
+
+            strokes[i]->pbStart += offsets[i];
+
+            strokes[i]->subevents.shiftPbIdx(offsets[i]);
+        }
+    }
+};
+
+
+SpriteGenerator::SpriteGenerator(float spacing, float canvasRatioSquared) :
+    spacing(spacing), ratioSquared(canvasRatioSquared)
+{
+}
+
+
+// Sprites of a single stroke, with its pbStart and pbIdx counted from 0
+void SpriteGenerator::generateStroke(PenStroke* stroke, QVector<StrokeSprite> &out)
+{
+    const GLubyte r = (GLubyte)(stroke->r * 255.0f + 0.5f);
+    const GLubyte g = (GLubyte)(stroke->g * 255.0f + 0.5f);
+    const GLubyte b = (GLubyte)(stroke->b * 255.0f + 0.5f);
+    const GLubyte size = (GLubyte)(stroke->ptSize + 0.5f);
+
+    SubeventColumns& subevents = stroke->subevents;
+    const qint16* xs = subevents.x.constData();
+    const qint16* ys = subevents.y.constData();
+    int* pbIdx = subevents.pbIdx.data();
+
+    out.clear();
+    stroke->pbStart = 0;
+
+    float extraDist = 0;
+
+    for (int s = 0; s < subevents.size(); s++)
+    {
+        float x1 = xs[s], y1 = ys[s];
+
+        // Sprites outside the page are dropped, as addStrokeSprite does
+        bool inRange1 = x1 >= SHRT_MIN && x1 <= SHRT_MAX && y1 >= SHRT_MIN && y1 <= SHRT_MAX;
+
+        if (s == 0)
+        {
+            // The stroke starts with a point, as addPoint
+            if (inRange1)
+            {
+                StrokeSprite sprite = {(GLshort)x1, (GLshort)y1, r, g, b, size};
+                out << sprite;
+            }
+
+            extraDist = spacing;
+        }
+        else
+        {
+            float x0 = xs[s-1], y0 = ys[s-1];
+            float w = x1 - x0, h = y1 - y0;
+
+            float dist = sqrt(h*h * ratioSquared + w*w);
+
+            // Sprites sit at extraDist + k * spacing along the line, for every one of them before its end
+            int n = dist > extraDist ? (int)ceil((dist - extraDist) / spacing) : 0;
+
+            if (n > 0)
+            {
+                float dx = w / dist, dy = h / dist;
+
+                int base = out.size();
+                out.resize(base + n);
+                StrokeSprite* dst = out.data() + base;
+
+                bool inRange0 = x0 >= SHRT_MIN && x0 <= SHRT_MAX && y0 >= SHRT_MIN && y0 <= SHRT_MAX;
+
+                // A line between two points on the page stays on it - no checks, so the loop can be vectorized
+                if (inRange0 && inRange1)
+                {
+                    for (int k = 0; k < n; k++)
+                    {
+                        float i = extraDist + k * spacing;
+
+                        dst[k].x = (GLshort)(x0 + dx * i);
+                        dst[k].y = (GLshort)(y0 + dy * i);
+                        dst[k].r = r;
+                        dst[k].g = g;
+                        dst[k].b = b;
+                        dst[k].size = size;
+                    }
+                }
+                else
+                {
+                    int kept = 0;
+
+                    for (int k = 0; k < n; k++)
+                    {
+                        float i = extraDist + k * spacing;
+                        float x = x0 + dx * i, y = y0 + dy * i;
+
+                        if (x < SHRT_MIN || x > SHRT_MAX || y < SHRT_MIN || y > SHRT_MAX) continue;
+
+                        StrokeSprite sprite = {(GLshort)x, (GLshort)y, r, g, b, size};
+                        dst[kept++] = sprite;
+                    }
+
+                    out.resize(base + kept);
+                }
+            }
+
+            extraDist += n * spacing - dist;
+        }
+
+        pbIdx[s] = out.size();
+    }
+}
+
+
+void SpriteGenerator::generate(const QVector<PenStroke*> &strokes, QVector<StrokeSprite> &sprites)
+{
+    strokeSprites.resize(strokes.size());
+    strokeSpritesData = strokeSprites.data();
+
+    QThreadPool pool;
+
+    int threads = qBound(1, strokes.size() / MIN_STROKES_PER_THREAD, QThread::idealThreadCount());
+    int perThread = qMax((strokes.size() + threads - 1) / threads, 1);
+
+    // First pass - every stroke on its own
+    for (int first = 0; first < strokes.size(); first += perThread)
+    {
+        pool.start(new SpriteGeneratorTask(this, strokes.constData(), first, qMin(perThread, strokes.size() - first), SpriteGeneratorTask::GENERATE));
+    }
+
+    pool.waitForDone();
+
+    // Give each stroke its range, in order
+    QVector<int> offsets(strokes.size());
+    int total = 0;
+
+    for (int i = 0; i < strokes.size(); i++)
+    {
+        offsets[i] = total;
+        total += strokeSprites[i].size();
+    }
+
+    // Second pass - copy them in place
+    sprites.resize(total);
+
+    for (int first = 0; first < strokes.size(); first += perThread)
+    {
+        pool.start(new SpriteGeneratorTask(this, strokes.constData(), first, qMin(perThread, strokes.size() - first), SpriteGeneratorTask::PLACE,
+                                           offsets.constData(), sprites.data()));
+    }
+
+    pool.waitForDone();
+
+    strokeSprites.clear();
+}
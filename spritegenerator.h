@@ -0,0 +1,32 @@
+#ifndef SPRITEGENERATOR_H
+#define SPRITEGENERATOR_H
+
+#include <QVector>
+
+#include "strokerenderer.h"
+
+class PenStroke;
+
+// Makes the sprites of whole strokes from their subevents, the way StrokeRenderer::addPoint and addStroke
+// do while drawing - for strokes that were loaded or whose sprites were thrown away.
+// Strokes are independent of each other, so they are spread over a thread pool, and each gets a contiguous range.
+class SpriteGenerator
+{
+    float spacing, ratioSquared;
+
+    // Sprites of each stroke, before they are given their final place
+    QVector< QVector<StrokeSprite> > strokeSprites;
+    QVector<StrokeSprite>* strokeSpritesData = NULL; // Taken before the threads start, so none of them detaches it
+
+    void generateStroke(PenStroke* stroke, QVector<StrokeSprite> &out);
+
+    friend class SpriteGeneratorTask;
+
+public:
+    SpriteGenerator(float spacing, float canvasRatioSquared);
+
+    // Replace the contents of sprites with the sprites of all strokes, setting their pbStart and pbIdx to match
+    void generate(const QVector<PenStroke*> &strokes, QVector<StrokeSprite> &sprites);
+};
+
+#endif
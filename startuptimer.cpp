@@ -0,0 +1,24 @@
+#include "startuptimer.h"
+
+#include <QDebug>
+
+QElapsedTimer StartupTimer::timer;
+qint64 StartupTimer::lastMarkMSec = 0;
+
+void StartupTimer::start()
+{
+    timer.start();
+    lastMarkMSec = 0;
+}
+
+
+void StartupTimer::mark(const char* phase)
+{
+    if (!timer.isValid()) return;
+
+    qint64 now = timer.elapsed();
+
+    qDebug() << "Startup:" << phase << "at" << now << "ms" << "(+" << now - lastMarkMSec << "ms )";
+
+    lastMarkMSec = now;
+}
@@ -0,0 +1,19 @@
+#ifndef STARTUPTIMER_H
+#define STARTUPTIMER_H
+
+#include <QElapsedTimer>
+
+// Logs how long each startup phase took, counted from the start of main - time-to-first-frame is what the Pi users notice
+class StartupTimer
+{
+    static QElapsedTimer timer;
+    static qint64 lastMarkMSec;
+
+public:
+    static void start();
+
+    // Logs the time since start and since the previous mark
+    static void mark(const char* phase);
+};
+
+#endif
@@ -1,18 +1,28 @@
 #include "strokerenderer.h"
+#include "glextensions.h"
 #include "timeline.h"
+#include "spritegenerator.h"
 #include <limits>
+#include <QElapsedTimer>
 #include <qmath.h>
 #include <vector>
+#include <string.h>
 
 
 #define VERTEX_COORD_SIZE 4
-#define N_SPRITES 10000000
+#define SPRITE_SIZE sizeof(StrokeSprite)
+#define SPRITES_PER_CHUNK 65536 // 512KB per sprite VBO chunk
+#define VERTICES_PER_SEGMENT 6
+#define MIN_SEGMENT_CAPACITY 4096
+#define SPARE_SPRITE_CHUNKS 1 // Kept past the packed sprites by compaction, so drawing on doesn't allocate right away
 
 StrokeRenderer* StrokeRenderer::si;
 
 StrokeRenderer::StrokeRenderer()
 {
     si = this;
+
+    setSpriteStyle(0, 0, 0, 3);
 }
 
 void StrokeRenderer::windowSizeChanged(int width, int height)
@@ -25,19 +35,19 @@ void StrokeRenderer::windowSizeChanged(int width, int height)
     zoom = canvasRatio * canvasSize.x() / canvasSize.y();
     scroll = viewportYStart * zoom * 2.0f;
 
-    strokeShader.shaderProgram.bind();
-    strokeShader.shaderProgram.setUniformValue(strokeZoomAndScrollLoc, zoom, scroll);
+    glState.useProgram(strokeShader.pId);
+    glState.setUniform(strokeZoomAndScrollLoc, zoom, scroll);
 
-    pickingShader.shaderProgram.bind();
-    pickingShader.shaderProgram.setUniformValue(pickingZoomAndScrollLoc, zoom, scroll);
+    glState.useProgram(pickingShader.pId);
+    glState.setUniform(pickingZoomAndScrollLoc, zoom, scroll);
 
-    selectionRectShader.shaderProgram.bind();
-    selectionRectShader.shaderProgram.setUniformValue(rectZoomAndScrollLoc, zoom, scroll);
+    glState.useProgram(selectionRectShader.pId);
+    glState.setUniform(rectZoomAndScrollLoc, zoom, scroll);
 
     scrollBar->setPageStep(scrollBarSize / zoom);
     scrollBar->setRange(0, scrollBarSize - scrollBar->pageStep());
 
-    Canvas::si->redrawRequested = true;
+    Canvas::si->requestRedraw();
 }
 
 void StrokeRenderer::setViewportYStart(float value)
@@ -46,16 +56,17 @@ void StrokeRenderer::setViewportYStart(float value)
 
     scroll = viewportYStart * zoom * 2.0f;
 
-    strokeShader.shaderProgram.bind();
-    strokeShader.shaderProgram.setUniformValue(strokeZoomAndScrollLoc, zoom, scroll);
+    glState.useProgram(strokeShader.pId);
+    glState.setUniform(strokeZoomAndScrollLoc, zoom, scroll);
 
-    pickingShader.shaderProgram.bind();
-    pickingShader.shaderProgram.setUniformValue(pickingZoomAndScrollLoc, zoom, scroll);
+    glState.useProgram(pickingShader.pId);
+    glState.setUniform(pickingZoomAndScrollLoc, zoom, scroll);
 
-    selectionRectShader.shaderProgram.bind();
-    selectionRectShader.shaderProgram.setUniformValue(rectZoomAndScrollLoc, zoom, scroll);
+    glState.useProgram(selectionRectShader.pId);
+    glState.setUniform(rectZoomAndScrollLoc, zoom, scroll);
 
-    Canvas::si->redrawRequested = true;
+    // The whole page is already in the ink atlas - only the blit moves
+    Canvas::si->update();
 }
 
 void StrokeRenderer::init()
@@ -63,53 +74,79 @@ void StrokeRenderer::init()
     // Start OpenGL
     INIT_OPENGL_FUNCTIONS();
 
+    glState.init();
+
     // Get a reference to the scrollBar widget - just for cleaner code
     scrollBar = MainWindow::si->getCanvasScrollBar();
 
 
-    // Setup stroke vertex buffers
-    glGenBuffers(1, &verticesId);
-    glBindBuffer(GL_ARRAY_BUFFER, verticesId);
-    glBufferData(GL_ARRAY_BUFFER, N_SPRITES, NULL, GL_STREAM_DRAW);
+    // Setup stroke vertex buffers - more chunks are added as the lecture grows
+    addSpriteChunk();
+
+    // Setup capsule segment buffer - grown on demand
+    glGenBuffers(1, &segmentsId);
 
     // Setup canvas geometry
     glGenBuffers(1, &rectId);
-    glBindBuffer(GL_ARRAY_BUFFER, rectId);
+    glState.bindArrayBuffer(rectId);
     glBufferData(GL_ARRAY_BUFFER, 4, NULL, GL_DYNAMIC_DRAW);
+    GpuResources::track(GpuResources::GEOMETRY, GpuResources::BUFFER, rectId, 64); // The largest rect it is given
 
 
     // Setup stroke shader
     strokeShader.init(QString("stroke"), {"inTexCoord"});
-    strokeShader.shaderProgram.bind();
+    glState.useProgram(strokeShader.pId);
     strokeColorLoc = strokeShader.shaderProgram.uniformLocation("strokeColor");
     strokeZoomAndScrollLoc = strokeShader.shaderProgram.uniformLocation("zoomAndScroll");
     strokeMatrix = strokeShader.shaderProgram.uniformLocation("manipulation");
 
     // Setup picking shader
     pickingShader.init(QString("picking"), {"inTexCoord"});
-    pickingShader.shaderProgram.bind();
+    glState.useProgram(pickingShader.pId);
     pickingColorLoc = pickingShader.shaderProgram.uniformLocation("strokeColor");
     pickingZoomAndScrollLoc = pickingShader.shaderProgram.uniformLocation("zoomAndScroll");
-    pickingMatrix = strokeShader.shaderProgram.uniformLocation("manipulation");
+    pickingMatrix = pickingShader.shaderProgram.uniformLocation("manipulation");
+    pickingPointSizeLoc = pickingShader.shaderProgram.uniformLocation("pointSize");
 
     // Setup canvas shader
     canvasShader.init(QString("canvas"), {});
-    canvasShader.shaderProgram.bind();
+    glState.useProgram(canvasShader.pId);
     samplerRectLoc = canvasShader.shaderProgram.uniformLocation("sampler");
     canvasShader.shaderProgram.setUniformValue(samplerRectLoc, 0);
 
     // Setup selection rect shader
     selectionRectShader.init(QString("selectionRect"), {});
-    selectionRectShader.shaderProgram.bind();
+    glState.useProgram(selectionRectShader.pId);
     rectZoomAndScrollLoc = selectionRectShader.shaderProgram.uniformLocation("zoomAndScroll");
 
+    // Setup batched stroke shader
+    batchShader.init(QString("strokeBatch"), {"inStyle"});
+    glState.useProgram(batchShader.pId);
+    batchZoomAndScrollLoc = batchShader.shaderProgram.uniformLocation("zoomAndScroll");
+    batchMatrixLoc = batchShader.shaderProgram.uniformLocation("manipulation");
+    batchPointScaleLoc = batchShader.shaderProgram.uniformLocation("pointScale");
+
+    // Setup capsule stroke shader
+    capsuleShader.init(QString("strokeCapsule"), {"inCorner", "inColor"});
+    glState.useProgram(capsuleShader.pId);
+    capsuleZoomAndScrollLoc = capsuleShader.shaderProgram.uniformLocation("zoomAndScroll");
+    capsuleMatrixLoc = capsuleShader.shaderProgram.uniformLocation("manipulation");
+    capsulePointScaleLoc = capsuleShader.shaderProgram.uniformLocation("pointScale");
+    capsuleViewportLoc = capsuleShader.shaderProgram.uniformLocation("viewportSize");
+    capsuleSpacingLoc = capsuleShader.shaderProgram.uniformLocation("spacingPx");
+
+    gpuPicking = QSettings().value("gpuPicking", false).toBool();
+
+    setRenderingMode(QSettings().value("renderingMode", QUAD_RENDERING).toInt());
+
 
     // Get cursor image
     QImage cursor = QGLWidget::convertToGLFormat( QImage(":/icons/icons/cursor32.png") );
 
     glGenTextures( 1, &cursorTexture );
     glBindTexture( GL_TEXTURE_2D, cursorTexture );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, cursor.width(), cursor.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, cursor.bits() );
+    glTexImage2D( GL_TEXTURE_2D, 0, GLExtensions::isES ? GL_RGBA : GL_RGBA8, cursor.width(), cursor.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, cursor.bits() );
+    GpuResources::track(GpuResources::CURSOR, GpuResources::TEXTURE, cursorTexture, cursor.width() * cursor.height() * 4);
 
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
@@ -117,6 +154,8 @@ void StrokeRenderer::init()
 
 int StrokeRenderer::addStroke(const QLineF &strokeLine)
 {
+    if (!spritesEnabled) return spriteCounter;
+
     float w = strokeLine.x2() - strokeLine.x1();
     float h = strokeLine.y2() - strokeLine.y1();
 
@@ -136,6 +175,8 @@ int StrokeRenderer::addStroke(const QLineF &strokeLine)
 
 int StrokeRenderer::addPoint(const QPointF &strokePoint)
 {
+    pointSpriteStart = spriteCounter;
+
     addStrokeSprite(strokePoint.x(), strokePoint.y());
 
     extraDist = spriteSpacing;
@@ -144,6 +185,7 @@ int StrokeRenderer::addPoint(const QPointF &strokePoint)
 }
 
 
+// Event IDs are EventRegistry handles, which fit the 24 bits of the color
 static void IDtoColor(float &r, float &g, float &b, const int &ID)
 {
     b = ( (ID >> 16) & 0xFF ) / 255.0f;
@@ -154,9 +196,7 @@ static void IDtoColor(float &r, float &g, float &b, const int &ID)
 
 static int colorToId(int r, int g, int b)
 {
-    return r +
-           ( (b << 8) & 0xFFFF ) +
-           ( (g << 16) & 0xFFFFFF );
+    return r | (g << 8) | (b << 16);
 }
 
 
@@ -165,6 +205,41 @@ void StrokeRenderer::processPicking()
     int x = Canvas::si->penIntPos.x();
     int y = Canvas::si->h - Canvas::si->penIntPos.y();
 
+    if (GLExtensions::asyncReadback)
+    {
+        if (pickingPixelBuffer == 0)
+        {
+            glGenBuffers(1, &pickingPixelBuffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pickingPixelBuffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, 4, NULL, GL_STREAM_READ);
+            GpuResources::track(GpuResources::PICKING, GpuResources::BUFFER, pickingPixelBuffer, 4);
+        }
+
+        // Queue the copy and come back for it in a later frame, once the GPU is done
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pickingPixelBuffer);
+        glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (pickingFence) GLExtensions::deleteSync(pickingFence);
+        pickingFence = GLExtensions::fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        if (pickingFence)
+        {
+            pickingPos = Canvas::si->penPos;
+            pickingPending = true;
+
+            // Nothing is selected until the result arrives, so early drags don't move the previous selection
+            Event::setActiveID(-1, pickingPos);
+
+            return;
+        }
+
+        // The driver doesn't really have fences - read synchronously from now on
+        qDebug("Picking fence not created, asynchronous readback disabled.");
+
+        GLExtensions::asyncReadback = false;
+    }
+
     GLubyte pickedPixel[4];
     glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pickedPixel);
 
@@ -173,9 +248,82 @@ void StrokeRenderer::processPicking()
     Event::setActiveID(colorToId(pickedPixel[0], pickedPixel[1], pickedPixel[2]), Canvas::si->penPos);
 }
 
+
+// Apply the result of an asynchronous picking, if the GPU has finished it
+void StrokeRenderer::pollPicking()
+{
+    if (!pickingPending) return;
+
+    GLenum status = GLExtensions::clientWaitSync(pickingFence, 0, 0);
+
+    if (status == GL_TIMEOUT_EXPIRED) return;
+
+    // Mapping the buffer waits for the copy, so the result is read synchronously - and so are later pickings
+    if (status == GL_WAIT_FAILED)
+    {
+        qDebug("Picking fence failed, asynchronous readback disabled.");
+
+        GLExtensions::asyncReadback = false;
+    }
+
+    GLExtensions::deleteSync(pickingFence);
+    pickingFence = NULL;
+    pickingPending = false;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pickingPixelBuffer);
+
+    GLubyte* pickedPixel = (GLubyte*) GLExtensions::mapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4, GL_MAP_READ_BIT);
+
+    if (pickedPixel)
+    {
+        int ID = colorToId(pickedPixel[0], pickedPixel[1], pickedPixel[2]);
+
+        GLExtensions::unmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+        Event::setActiveID(ID, pickingPos);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    Canvas::si->update();
+}
+
+// Stroke radius used for picking, in SHRT units along x - the same size the picking sprites are drawn with
+float StrokeRenderer::getPickingRadius(float ptSize)
+{
+    return (ptSize + pickingSizeAdjustment) * normalSizeAdjustment * SHRT_MAX;
+}
+
+
+// Whether a rect in SHRT units (top being its highest y) overlaps what is being drawn to - the whole page
+// for the ink atlas, the visible part of the canvas for picking
+bool StrokeRenderer::isInRenderTarget(const QRectF &rect)
+{
+    float visibleTop, visibleBottom;
+    getRenderTargetRange(visibleTop, visibleBottom);
+
+    return rect.bottom() <= visibleTop && rect.top() >= visibleBottom;
+}
+
+
+void StrokeRenderer::getRenderTargetRange(float &visibleTop, float &visibleBottom)
+{
+    visibleTop = SHRT_MAX;
+    visibleBottom = -SHRT_MAX;
+
+    if (Canvas::si->pickingRequested)
+    {
+        // The inverse of the zoom and scroll done in the vertex shaders
+        visibleTop = (zoom - scroll) / zoom * SHRT_MAX;
+        visibleBottom = (zoom - 2.0f - scroll) / zoom * SHRT_MAX;
+    }
+}
+
+
 void StrokeRenderer::renderSelectionRect(QRectF rect)
 {
-    qDebug() << rect;
+    // Events hold their rects in SHRT units, the shader works in normalized ones
+    rect = QRectF(rect.topLeft() / SHRT_MAX, rect.bottomRight() / SHRT_MAX);
 
     float padding = zoom * (1.0 / 300.0);
 
@@ -184,17 +332,15 @@ void StrokeRenderer::renderSelectionRect(QRectF rect)
                         rect.right() + padding, rect.top() + padding,
                         rect.right() + padding, rect.bottom() - padding};
 
-    glUseProgram(selectionRectShader.pId);
+    glState.useProgram(selectionRectShader.pId);
 
-    glBindBuffer(GL_ARRAY_BUFFER, rectId);
+    glState.bindArrayBuffer(rectId);
     glBufferData(GL_ARRAY_BUFFER, 32, posArray, GL_DYNAMIC_DRAW);
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, 8, (void*)0);
-    glEnableVertexAttribArray(0);
+    glState.vertexAttribPointer(0, 2, GL_FLOAT, false, 8, (void*)0);
+    glState.setEnabledAttribs(1 << 0);
 
     glDrawArrays(GL_LINE_LOOP, 0, 4);
-
-    glDisableVertexAttribArray(0);
 }
 
 
@@ -206,17 +352,597 @@ int StrokeRenderer::getCurrentSpriteCounter()
 
 void StrokeRenderer::addStrokeSprite(float x, float y)
 {
+    if (!spritesEnabled) return;
+
     if (x < SHRT_MIN || x > SHRT_MAX || y < SHRT_MIN || y > SHRT_MAX) return;
 
-    if(spriteCounter < N_SPRITES)
+    StrokeSprite sprite = {(GLshort)x, (GLshort)y, spriteStyle[0], spriteStyle[1], spriteStyle[2], spriteStyle[3]};
+
+    // Just stage it - uploadPendingSprites() sends it to the GPU before the next frame is drawn
+    sprites << sprite;
+
+    markSpritesDirty(spriteCounter, spriteCounter + 1);
+
+    spriteCounter++;
+}
+
+
+void StrokeRenderer::regenerateSprites(const QVector<Event*> &events)
+{
+    if (!spritesEnabled) return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<PenStroke*> strokes;
+
+    for (Event* ev : events)
+    {
+        if (ev->type == Event::STROKE_EVENT) strokes << (PenStroke*)ev;
+    }
+
+    SpriteGenerator(spriteSpacing, canvasRatioSquared).generate(strokes, sprites);
+
+    spriteCounter = sprites.size();
+    pointSpriteStart = spriteCounter;
+    extraDist = 0;
+
+    // Everything goes up at once, a transfer per chunk
+    dirtyFrom = dirtyTo = 0;
+    markSpritesDirty(0, spriteCounter);
+
+    qDebug() << "Regenerated" << spriteCounter << "sprites of" << strokes.size() << "strokes in" << timer.elapsed() << "ms";
+}
+
+
+// Called once the stroke that owns the upcoming sprites is known
+void StrokeRenderer::setSpriteStyle(float r, float g, float b, float ptSize)
+{
+    spriteStyle[0] = (GLubyte)(r * 255.0f + 0.5f);
+    spriteStyle[1] = (GLubyte)(g * 255.0f + 0.5f);
+    spriteStyle[2] = (GLubyte)(b * 255.0f + 0.5f);
+    spriteStyle[3] = (GLubyte)(ptSize + 0.5f);
+
+    // The stroke's first point is generated before the stroke itself exists, so restyle it
+    if (pointSpriteStart == spriteCounter) return;
+
+    for (int i = pointSpriteStart; i < spriteCounter; i++)
+    {
+        sprites[i].r = spriteStyle[0];
+        sprites[i].g = spriteStyle[1];
+        sprites[i].b = spriteStyle[2];
+        sprites[i].size = spriteStyle[3];
+    }
+
+    markSpritesDirty(pointSpriteStart, spriteCounter);
+}
+
+
+void StrokeRenderer::markSpritesDirty(int from, int to)
+{
+    if (dirtyFrom == dirtyTo)
+    {
+        dirtyFrom = from;
+        dirtyTo = to;
+    }
+    else
+    {
+        dirtyFrom = qMin(dirtyFrom, from);
+        dirtyTo = qMax(dirtyTo, to);
+    }
+}
+
+
+// Send every sprite staged since the last frame - a single transfer, unless it crosses a chunk boundary
+void StrokeRenderer::uploadPendingSprites()
+{
+    uploadsLastFrame = uploadsThisFrame;
+    uploadsThisFrame = 0;
+
+    glState.beginFrame();
+
+    // Compaction may only have cut the tail, leaving nothing to upload
+    if (spareChunksPending && dirtyFrom == dirtyTo) releaseSpareSpriteChunks();
+
+    if (dirtyFrom == dirtyTo) return;
+
+    while (spriteChunks.size() * SPRITES_PER_CHUNK < dirtyTo) addSpriteChunk();
+
+    for (int from = dirtyFrom; from < dirtyTo; )
+    {
+        int chunk = from / SPRITES_PER_CHUNK;
+        int to = qMin(dirtyTo, (chunk + 1) * SPRITES_PER_CHUNK);
+
+        int offset = (from - chunk * SPRITES_PER_CHUNK) * SPRITE_SIZE;
+        int size = (to - from) * SPRITE_SIZE;
+
+        glState.bindArrayBuffer(spriteChunks[chunk]);
+
+        void* mapped = NULL;
+
+        if (GLExtensions::mapBufferRange)
+        {
+            // The whole range is rewritten, so its old content can be thrown away
+            mapped = GLExtensions::mapBufferRange(GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        }
+
+        if (mapped)
+        {
+            memcpy(mapped, sprites.constData() + from, size);
+            GLExtensions::unmapBuffer(GL_ARRAY_BUFFER);
+        }
+        else
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, offset, size, sprites.constData() + from);
+        }
+
+        uploadsThisFrame++;
+
+        from = to;
+    }
+
+    dirtyFrom = dirtyTo = 0;
+
+    if (spareChunksPending) releaseSpareSpriteChunks();
+}
+
+
+void StrokeRenderer::addSpriteChunk()
+{
+    GLuint chunkId;
+
+    // The ink can't do without it - the caches make room if they can
+    GpuResources::reserve(SPRITES_PER_CHUNK * SPRITE_SIZE, GpuResources::SPRITES);
+
+    glGenBuffers(1, &chunkId);
+    glState.bindArrayBuffer(chunkId);
+    glBufferData(GL_ARRAY_BUFFER, SPRITES_PER_CHUNK * SPRITE_SIZE, NULL, GL_DYNAMIC_DRAW);
+    GpuResources::track(GpuResources::SPRITES, GpuResources::BUFFER, chunkId, SPRITES_PER_CHUNK * SPRITE_SIZE);
+
+    spriteChunks << chunkId;
+
+    qDebug() << "Sprite pool grown to" << spriteChunks.size() << "chunks";
+}
+
+
+SpritePoolStats StrokeRenderer::getSpritePoolStats()
+{
+    SpritePoolStats stats;
+
+    stats.spritesPerChunk = SPRITES_PER_CHUNK;
+    stats.chunkCount = spriteChunks.size();
+    stats.usedSprites = spriteCounter;
+    stats.capacity = spriteChunks.size() * SPRITES_PER_CHUNK;
+    stats.bytesAllocated = stats.capacity * SPRITE_SIZE;
+
+    for (int i = 0; i < spriteChunks.size(); i++)
+    {
+        stats.chunkOccupancy << qBound(0, spriteCounter - i * SPRITES_PER_CHUNK, SPRITES_PER_CHUNK) / (float)SPRITES_PER_CHUNK;
+    }
+
+    stats.liveSprites = 0;
+
+    for (const SpriteRange& range : findLiveSpriteRanges(findLiveStrokes()))
+    {
+        stats.liveSprites += range.to - range.from;
+    }
+
+    stats.deadSprites = spriteCounter - stats.liveSprites;
+    stats.deadRatio = spriteCounter > 0 ? stats.deadSprites / (float)spriteCounter : 0.0f;
+
+    return stats;
+}
+
+
+// Strokes that still draw from the sprite buffer - the lecture's and the clipboard's
+QVector<PenStroke*> StrokeRenderer::findLiveStrokes()
+{
+    QVector<PenStroke*> strokes;
+
+    if (!Timeline::si) return strokes;
+
+    for (Event* ev : Timeline::si->events + Timeline::si->eventsClipboard)
     {
-        GLshort posArray[] = {(GLshort)x, (GLshort)y};
+        if (ev->type == Event::STROKE_EVENT && !((PenStroke*)ev)->subevents.isEmpty()) strokes << (PenStroke*)ev;
+    }
+
+    return strokes;
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, verticesId);
-        glBufferSubData(GL_ARRAY_BUFFER, spriteCounter*VERTEX_COORD_SIZE, VERTEX_COORD_SIZE, posArray);
 
-        spriteCounter++;
+bool StrokeRenderer::spriteRangeLessThan(const SpriteRange &r1, const SpriteRange &r2)
+{
+    return r1.from < r2.from;
+}
+
+
+// Sorted and disjoint - clones share their sprites with the original, and a stroke whose first point was dropped
+// starts inside the stroke before it, so overlapping and touching ranges are merged
+QVector<StrokeRenderer::SpriteRange> StrokeRenderer::findLiveSpriteRanges(const QVector<PenStroke*> &strokes)
+{
+    QVector<SpriteRange> ranges;
+
+    for (PenStroke* stroke : strokes)
+    {
+        const QVector<int>& pbIdx = stroke->subevents.pbIdx;
+
+        SpriteRange range = {qMax(stroke->pbStart, 0), qMin(pbIdx.at(pbIdx.size() - 1), spriteCounter), 0};
+
+        if (range.from < range.to) ranges << range;
     }
+
+    qSort(ranges.begin(), ranges.end(), spriteRangeLessThan);
+
+    int merged = 0;
+
+    for (int i = 0; i < ranges.size(); i++)
+    {
+        if (merged > 0 && ranges[i].from <= ranges[merged - 1].to)
+        {
+            ranges[merged - 1].to = qMax(ranges[merged - 1].to, ranges[i].to);
+        }
+        else
+        {
+            ranges[merged++] = ranges[i];
+        }
+    }
+
+    ranges.resize(merged);
+
+    return ranges;
+}
+
+
+// Where sprite index idx ends up once the ranges are packed - indexes between ranges go to the end of the one before
+int StrokeRenderer::mapSpriteIndex(const QVector<SpriteRange> &ranges, int idx)
+{
+    SpriteRange value = {idx, idx, 0};
+
+    int i = qUpperBound(ranges.begin(), ranges.end(), value, spriteRangeLessThan) - ranges.begin() - 1;
+
+    if (i < 0) return 0;
+
+    return ranges[i].newFrom + qMin(idx, ranges[i].to) - ranges[i].from;
+}
+
+
+int StrokeRenderer::compactSprites()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<PenStroke*> strokes = findLiveStrokes();
+    QVector<SpriteRange> ranges = findLiveSpriteRanges(strokes);
+
+    // Every range moves down or stays, so they can be packed in place, in order
+    int packed = 0;
+    int firstMoved = -1;
+
+    for (SpriteRange& range : ranges)
+    {
+        range.newFrom = packed;
+
+        if (range.from != packed)
+        {
+            if (firstMoved < 0) firstMoved = packed;
+
+            memmove(sprites.data() + packed, sprites.constData() + range.from, (range.to - range.from) * SPRITE_SIZE);
+        }
+
+        packed += range.to - range.from;
+    }
+
+    int reclaimed = spriteCounter - packed;
+
+    if (reclaimed == 0) return 0;
+
+    // The strokes follow their sprites - a clone and its original are both moved, by the same amount
+    for (PenStroke* stroke : strokes)
+    {
+        if (stroke->pbStart >= 0) stroke->pbStart = mapSpriteIndex(ranges, stroke->pbStart);
+
+        for (int& pbIdx : stroke->subevents.pbIdx)
+        {
+            pbIdx = mapSpriteIndex(ranges, pbIdx);
+        }
+    }
+
+    sprites.resize(packed);
+    spriteCounter = packed;
+    pointSpriteStart = spriteCounter;
+
+    // What moved goes up again, along with whatever was already waiting below the new end
+    if (firstMoved < 0) firstMoved = packed;
+
+    int from = dirtyFrom == dirtyTo ? firstMoved : qMin(dirtyFrom, firstMoved);
+    dirtyFrom = qMin(from, packed);
+    dirtyTo = packed;
+
+    spareChunksPending = true;
+
+    qDebug() << "Compacted sprites:" << reclaimed << "dead ones reclaimed," << packed << "left, in" << timer.elapsed() << "ms";
+
+    return reclaimed;
+}
+
+
+// GL side of compactSprites()
+void StrokeRenderer::releaseSpareSpriteChunks()
+{
+    spareChunksPending = false;
+
+    int needed = (spriteCounter + SPRITES_PER_CHUNK - 1) / SPRITES_PER_CHUNK + SPARE_SPRITE_CHUNKS;
+
+    if (spriteChunks.size() <= needed) return;
+
+    while (spriteChunks.size() > needed)
+    {
+        GLuint chunkId = spriteChunks.takeLast();
+
+        GpuResources::untrack(GpuResources::BUFFER, chunkId);
+        glDeleteBuffers(1, &chunkId);
+    }
+
+    qDebug() << "Sprite pool shrunk to" << spriteChunks.size() << "chunks";
+}
+
+
+// Draw sprite ranges given in global indexes, splitting them where they cross chunk boundaries.
+// Ranges are submitted in the order given, so the blended result is the same as drawing them one by one.
+void StrokeRenderer::drawSpriteRanges(const GLint* firsts, const GLsizei* counts, int n, bool withStyle)
+{
+    int boundChunk = -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        int from = firsts[i];
+        int to = firsts[i] + counts[i];
+
+        while (from < to)
+        {
+            int chunk = from / SPRITES_PER_CHUNK;
+            int chunkStart = chunk * SPRITES_PER_CHUNK;
+            int pieceTo = qMin(to, chunkStart + SPRITES_PER_CHUNK);
+
+            if (chunk >= spriteChunks.size()) break; // Not uploaded yet
+
+            if (chunk != boundChunk)
+            {
+                submitChunkRanges(GL_POINTS);
+
+                glState.bindArrayBuffer(spriteChunks[chunk]);
+                glState.vertexAttribPointer(0, 2, GL_SHORT, true, SPRITE_SIZE, 0);
+                if (withStyle) glState.vertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, false, SPRITE_SIZE, (void*)VERTEX_COORD_SIZE);
+
+                boundChunk = chunk;
+            }
+
+            chunkFirsts << from - chunkStart;
+            chunkCounts << pieceTo - from;
+
+            from = pieceTo;
+        }
+    }
+
+    submitChunkRanges(GL_POINTS);
+}
+
+
+void StrokeRenderer::submitChunkRanges(GLenum mode)
+{
+    if (chunkFirsts.isEmpty()) return;
+
+    if (GLExtensions::multiDrawArrays)
+    {
+        GLExtensions::multiDrawArrays(mode, chunkFirsts.constData(), chunkCounts.constData(), chunkFirsts.size());
+    }
+    else
+    {
+        for (int i = 0; i < chunkFirsts.size(); i++)
+        {
+            glDrawArrays(mode, chunkFirsts[i], chunkCounts[i]);
+        }
+    }
+
+    chunkFirsts.resize(0);
+    chunkCounts.resize(0);
+}
+
+
+void StrokeRenderer::setRenderingMode(int mode)
+{
+    renderingMode = mode;
+
+    bool wasEnabled = spritesEnabled;
+    spritesEnabled = renderingMode == SPRITE_RENDERING || gpuPicking;
+
+    if (spritesEnabled && !wasEnabled && Timeline::si)
+    {
+        regenerateSprites(Timeline::si->events + Timeline::si->eventsClipboard);
+    }
+    else if (!spritesEnabled)
+    {
+        // Every stroke is left with an empty range at 0, and the chunks but one go with the next upload
+        for (PenStroke* stroke : findLiveStrokes())
+        {
+            stroke->pbStart = 0;
+            stroke->subevents.pbIdx.fill(0);
+        }
+
+        sprites.clear();
+        spriteCounter = pointSpriteStart = 0;
+        dirtyFrom = dirtyTo = 0;
+        spareChunksPending = true;
+    }
+
+    Canvas::si->keyframes.invalidateAll();
+    Canvas::si->requestRedraw();
+}
+
+
+// Picking always uses the sprites, as the ID colors must not be blended
+bool StrokeRenderer::drawsSegments()
+{
+    return renderingMode == QUAD_RENDERING && !Canvas::si->pickingRequested;
+}
+
+
+int StrokeRenderer::getSegmentCount()
+{
+    return segmentVertices.size() / VERTICES_PER_SEGMENT;
+}
+
+
+float StrokeRenderer::getDeadSegmentRatio()
+{
+    int segmentCount = getSegmentCount();
+
+    if (segmentCount == 0) return 0;
+
+    int liveSegments = 0;
+
+    for (PenStroke* stroke : findLiveStrokes())
+    {
+        if (stroke->segStart >= 0) liveSegments += stroke->segCount;
+    }
+
+    return (segmentCount - liveSegments) / (float)segmentCount;
+}
+
+
+bool StrokeRenderer::segStartLessThan(PenStroke* s1, PenStroke* s2)
+{
+    return s1->segStart < s2->segStart;
+}
+
+
+int StrokeRenderer::compactSegments()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Unlike sprites, no two strokes share segments - a clone makes its own
+    QVector<PenStroke*> strokes;
+
+    for (PenStroke* stroke : findLiveStrokes())
+    {
+        if (stroke->segStart >= 0 && stroke->segCount > 0) strokes << stroke;
+    }
+
+    qSort(strokes.begin(), strokes.end(), segStartLessThan);
+
+    int packed = 0;
+    int firstMoved = -1;
+
+    for (PenStroke* stroke : strokes)
+    {
+        if (stroke->segStart != packed)
+        {
+            if (firstMoved < 0) firstMoved = packed;
+
+            memmove(segmentVertices.data() + packed * VERTICES_PER_SEGMENT,
+                    segmentVertices.constData() + stroke->segStart * VERTICES_PER_SEGMENT,
+                    stroke->segCount * VERTICES_PER_SEGMENT * sizeof(SegmentVertex));
+
+            stroke->segStart = packed;
+        }
+
+        packed += stroke->segCount;
+    }
+
+    int reclaimed = getSegmentCount() - packed;
+
+    if (reclaimed == 0) return 0;
+
+    segmentVertices.resize(packed * VERTICES_PER_SEGMENT);
+
+    // What moved goes up again - all of it, in a smaller buffer, if most of the buffer is now empty
+    segmentsUploaded = qMin(segmentsUploaded, firstMoved < 0 ? packed : firstMoved);
+
+    if (segmentCapacity > 2 * qMax(packed, MIN_SEGMENT_CAPACITY)) segmentCapacity = 0;
+
+    qDebug() << "Compacted segments:" << reclaimed << "dead ones reclaimed," << packed << "left, in" << timer.elapsed() << "ms";
+
+    return reclaimed;
+}
+
+
+// Add one capsule going from (x0,y0) to (x1,y1) - a dot, if both ends are the same
+int StrokeRenderer::addStrokeSegment(float x0, float y0, float x1, float y1, float r, float g, float b, float ptSize, bool firstLine)
+{
+    static const GLbyte corners[VERTICES_PER_SEGMENT][2] = { {-1,-1}, {1,-1}, {1,1}, {-1,-1}, {1,1}, {-1,1} };
+
+    SegmentVertex vertex;
+
+    vertex.x0 = (GLshort)qBound((float)SHRT_MIN, x0, (float)SHRT_MAX);
+    vertex.y0 = (GLshort)qBound((float)SHRT_MIN, y0, (float)SHRT_MAX);
+    vertex.x1 = (GLshort)qBound((float)SHRT_MIN, x1, (float)SHRT_MAX);
+    vertex.y1 = (GLshort)qBound((float)SHRT_MIN, y1, (float)SHRT_MAX);
+    vertex.size = (GLbyte)(ptSize + 0.5f);
+    vertex.firstLine = firstLine ? 1 : 0;
+    vertex.r = (GLubyte)(r * 255.0f + 0.5f);
+    vertex.g = (GLubyte)(g * 255.0f + 0.5f);
+    vertex.b = (GLubyte)(b * 255.0f + 0.5f);
+    vertex.a = 255;
+
+    for (int i = 0; i < VERTICES_PER_SEGMENT; i++)
+    {
+        vertex.along = corners[i][0];
+        vertex.across = corners[i][1];
+
+        segmentVertices << vertex;
+    }
+
+    return getSegmentCount();
+}
+
+
+void StrokeRenderer::clearSegments()
+{
+    segmentVertices.clear();
+    segmentsUploaded = 0;
+    segmentCapacity = 0;
+}
+
+
+void StrokeRenderer::uploadPendingSegments()
+{
+    int segmentCount = getSegmentCount();
+
+    // A capacity of 0 asks for a new buffer, after compaction
+    if (segmentsUploaded == segmentCount && segmentCapacity > 0) return;
+
+    glState.bindArrayBuffer(segmentsId);
+
+    if (segmentCount > segmentCapacity || segmentCapacity == 0)
+    {
+        // Grow by doubling and send everything again
+        segmentCapacity = qMax(segmentCount, qMax(segmentCapacity * 2, MIN_SEGMENT_CAPACITY));
+
+        qint64 bytes = segmentCapacity * VERTICES_PER_SEGMENT * sizeof(SegmentVertex);
+        GpuResources::reserve(bytes - GpuResources::getBytesUsed(GpuResources::SEGMENTS), GpuResources::SEGMENTS);
+
+        glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+        GpuResources::track(GpuResources::SEGMENTS, GpuResources::BUFFER, segmentsId, bytes);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, segmentVertices.size() * sizeof(SegmentVertex), segmentVertices.constData());
+    }
+    else
+    {
+        int from = segmentsUploaded * VERTICES_PER_SEGMENT;
+
+        glBufferSubData(GL_ARRAY_BUFFER, from * sizeof(SegmentVertex),
+                        (segmentVertices.size() - from) * sizeof(SegmentVertex), segmentVertices.constData() + from);
+    }
+
+    uploadsThisFrame++;
+
+    segmentsUploaded = segmentCount;
+}
+
+
+int StrokeRenderer::getUploadsLastFrame()
+{
+    return uploadsLastFrame;
 }
 
 
@@ -236,60 +962,184 @@ void StrokeRenderer::drawStrokeSpritesRange(int from, int to, float r, float g,
     {
         IDtoColor(r, g, b, ID);
 
-        glPointSize( (ptSize + pickingSizeAdjustment) * (canvasSize.x() * normalSizeAdjustment));
+        glState.useProgram(pickingShader.pId);
+        glState.setUniform(pickingPointSizeLoc, (ptSize + pickingSizeAdjustment) * (canvasSize.x() * normalSizeAdjustment));
+        glState.setUniform(pickingColorLoc, r, g, b);
+        glState.setUniform(pickingMatrix, transform);
 
-        glUseProgram(pickingShader.pId);
-        pickingShader.shaderProgram.setUniformValue(pickingColorLoc, r, g, 0);
-        pickingShader.shaderProgram.setUniformValue(pickingMatrix, transform);
+        GLint first = from;
+        GLsizei count = to - from;
 
-        glBindBuffer(GL_ARRAY_BUFFER, verticesId);
-        glVertexAttribPointer(0, 2, GL_SHORT, true, VERTEX_COORD_SIZE, 0);
+        glState.setEnabledAttribs(1 << 0);
 
-        glEnableVertexAttribArray(0);
+        drawSpriteRanges(&first, &count, 1, false);
+    }
+    else // Render normally - color and size are stored in the sprites, so just queue the range
+    {
+        queueStrokeRange(from, to, transform, false);
+    }
+}
+
+
+void StrokeRenderer::drawStrokeSegmentsRange(int from, int to, QMatrix4x4 transform)
+{
+    queueStrokeRange(from * VERTICES_PER_SEGMENT, to * VERTICES_PER_SEGMENT, transform, true);
+}
 
-        glDrawArrays(GL_POINTS, from, to - from);
 
-        glDisableVertexAttribArray(0);
+void StrokeRenderer::queueStrokeRange(int from, int to, const QMatrix4x4 &transform, bool segments)
+{
+    if (to <= from) return;
+
+    // A new run is started whenever the transform or the geometry changes, so the drawing order is kept
+    if (batchRuns.isEmpty() || batchRuns.last().transform != transform || batchRuns.last().segments != segments)
+    {
+        batchRuns << BatchRun(transform, segments, batchFirsts.size());
     }
-    else // Render normally
+    // Strokes are usually contiguous in the sprite buffer - just grow the previous range
+    else if (batchFirsts.last() + batchCounts.last() == from)
+    {
+        batchCounts.last() += to - from;
+        return;
+    }
+
+    batchFirsts << from;
+    batchCounts << to - from;
+    batchRuns.last().rangeCount++;
+}
+
+
+// Draw every queued range into every tile of the ink atlas - one draw call per run of strokes sharing the same
+// transform (and sprite chunk)
+void StrokeRenderer::flushStrokeBatch()
+{
+    if (batchRuns.isEmpty()) return;
+
+    uploadPendingSegments();
+
+    InkAtlas& atlas = Canvas::si->atlas;
+
+    for (int i = 0; i < atlas.getTileCount(); i++)
     {
-        glPointSize(ptSize * (canvasSize.x() * normalSizeAdjustment));
+        atlas.bindTile(i);
+
+        setBatchTarget(atlas.getTileZoom(i), atlas.getTileScroll(i), atlas.getWidth(), atlas.getTile(i).height);
+
+        drawBatchRuns();
+    }
+
+    atlas.release();
 
-        glUseProgram(strokeShader.pId);
-        strokeShader.shaderProgram.setUniformValue(strokeColorLoc, r, g, b);
-        strokeShader.shaderProgram.setUniformValue(strokeMatrix, transform);
+    clearBatch();
+}
+
+
+// Draw every queued range into the bound framebuffer, with the zoom and scroll of the screen
+void StrokeRenderer::flushStrokeBatchToScreen()
+{
+    if (batchRuns.isEmpty()) return;
+
+    uploadPendingSegments();
+
+    setBatchTarget(zoom, scroll, canvasSize.x(), canvasSize.y());
+
+    drawBatchRuns();
+
+    clearBatch();
+}
+
+
+void StrokeRenderer::setBatchTarget(float zoom, float scroll, float width, float height)
+{
+    // Stroke sizes follow the width of what is drawn to, which may be scaled down from the screen
+    batchTargetWidth = width;
+
+    glState.useProgram(batchShader.pId);
+    glState.setUniform(batchZoomAndScrollLoc, zoom, scroll);
+
+    glState.useProgram(capsuleShader.pId);
+    glState.setUniform(capsuleZoomAndScrollLoc, zoom, scroll);
+    glState.setUniform(capsuleViewportLoc, width, height);
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, verticesId);
-        glVertexAttribPointer(0, 2, GL_SHORT, true, VERTEX_COORD_SIZE, 0);
 
-        glEnableVertexAttribArray(0);
+void StrokeRenderer::clearBatch()
+{
+    batchRuns.resize(0);
+    batchFirsts.resize(0);
+    batchCounts.resize(0);
+}
 
-        glDrawArrays(GL_POINTS, from, to - from);
 
-        glDisableVertexAttribArray(0);
+void StrokeRenderer::drawBatchRuns()
+{
+    float pointScale = batchTargetWidth * normalSizeAdjustment;
+
+    int setupFor = -1; // Which kind of geometry the program and attributes are set up for
+
+    for (const BatchRun& run : batchRuns)
+    {
+        if (run.segments && setupFor != QUAD_RENDERING)
+        {
+            glState.useProgram(capsuleShader.pId);
+            glState.setUniform(capsulePointScaleLoc, pointScale);
+            glState.setUniform(capsuleSpacingLoc, (float)(batchTargetWidth * spriteSpacing / (2.0f * SHRT_MAX)));
+
+            glState.bindArrayBuffer(segmentsId);
+            glState.vertexAttribPointer(0, 4, GL_SHORT, true, sizeof(SegmentVertex), 0);
+            glState.vertexAttribPointer(1, 4, GL_BYTE, false, sizeof(SegmentVertex), (void*)8);
+            glState.vertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, false, sizeof(SegmentVertex), (void*)12);
+
+            glState.setEnabledAttribs((1 << 0) | (1 << 1) | (1 << 2));
+
+            setupFor = QUAD_RENDERING;
+        }
+        else if (!run.segments && setupFor != SPRITE_RENDERING)
+        {
+            glState.useProgram(batchShader.pId);
+            glState.setUniform(batchPointScaleLoc, pointScale);
+
+            glState.setEnabledAttribs((1 << 0) | (1 << 1));
+
+            setupFor = SPRITE_RENDERING;
+        }
+
+        if (run.segments)
+        {
+            glState.setUniform(capsuleMatrixLoc, run.transform);
+
+            for (int i = run.firstRange; i < run.firstRange + run.rangeCount; i++)
+            {
+                chunkFirsts << batchFirsts[i];
+                chunkCounts << batchCounts[i];
+            }
+            submitChunkRanges(GL_TRIANGLES);
+        }
+        else
+        {
+            glState.setUniform(batchMatrixLoc, run.transform);
+
+            drawSpriteRanges(batchFirsts.constData() + run.firstRange, batchCounts.constData() + run.firstRange, run.rangeCount, true);
+        }
     }
 }
 
 
-void StrokeRenderer::drawTexturedRect(float x, float y, float w, float h)
+void StrokeRenderer::drawTexturedRect(float x, float y, float w, float h, float t0, float t1)
 {
-    float posArray[] = {x,   y,   0, 1,
-                        x,   y+h, 0, 0,
-                        x+w, y+h, 1, 0,
-                        x+w, y,	  1, 1};
+    float posArray[] = {x,   y,   0, t0,
+                        x,   y+h, 0, t1,
+                        x+w, y+h, 1, t1,
+                        x+w, y,	  1, t0};
 
-    glUseProgram(canvasShader.pId);
+    glState.useProgram(canvasShader.pId);
 
-    glBindBuffer(GL_ARRAY_BUFFER, rectId);
+    glState.bindArrayBuffer(rectId);
     glBufferData(GL_ARRAY_BUFFER, 64, posArray, GL_DYNAMIC_DRAW);
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, 16, (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, false, 16, (void*)8);
-    glEnableVertexAttribArray(1);
+    glState.vertexAttribPointer(0, 2, GL_FLOAT, false, 16, (void*)0);
+    glState.vertexAttribPointer(1, 2, GL_FLOAT, false, 16, (void*)8);
+    glState.setEnabledAttribs((1 << 0) | (1 << 1));
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
 }
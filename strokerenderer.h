@@ -4,37 +4,126 @@
 #include <qscrollbar.h>
 #include <QColor>
 
-#if QT_VERSION >= 0x050000
-    #include <QOpenGLFunctions>
-    #define INIT_OPENGL_FUNCTIONS initializeOpenGLFunctions
-    #define OPENGL_FUNCTIONS QOpenGLFunctions
-#else
-    #include <QGLFunctions>
-    #define INIT_OPENGL_FUNCTIONS initializeGLFunctions
-    #define OPENGL_FUNCTIONS QGLFunctions
-#endif
-
 #include "shader.h"
+#include "glstate.h"
+#include "gpuresources.h"
+
+class Event;
+class PenStroke;
+
+struct StrokeSprite
+{
+    GLshort x, y;
+    GLubyte r, g, b, size;
+};
+
+struct SpritePoolStats
+{
+    int chunkCount, spritesPerChunk;
+    int usedSprites, capacity;
+    int bytesAllocated;
+    QVector<float> chunkOccupancy; // From 0 (empty) to 1 (full), per chunk
+
+    // Sprites no stroke of the lecture or the clipboard draws anymore - what compactSprites() would reclaim
+    int liveSprites, deadSprites;
+    float deadRatio; // Of usedSprites
+};
+
+// One corner of a capsule quad - every segment is made of 2 triangles, all carrying both segment ends
+struct SegmentVertex
+{
+    GLshort x0, y0, x1, y1;
+    GLbyte along, across, size, firstLine;
+    GLubyte r, g, b, a;
+};
 
 class StrokeRenderer : protected OPENGL_FUNCTIONS
 {
     int strokeColorLoc, strokeZoomAndScrollLoc, strokeMatrix;
-    int pickingColorLoc, pickingZoomAndScrollLoc, pickingMatrix;
+    int pickingColorLoc, pickingZoomAndScrollLoc, pickingMatrix, pickingPointSizeLoc;
     int rectZoomAndScrollLoc;
     int samplerRectLoc;
+    int batchZoomAndScrollLoc, batchMatrixLoc, batchPointScaleLoc;
+    int capsuleZoomAndScrollLoc, capsuleMatrixLoc, capsulePointScaleLoc, capsuleViewportLoc, capsuleSpacingLoc;
 
     float extraDist = 0;
     int spriteCounter = 0;
+    int pointSpriteStart = 0;
+    GLubyte spriteStyle[4];
+
+    // CPU copy of the sprite buffer - sprites are staged here and uploaded once per frame
+    QVector<StrokeSprite> sprites;
+    int dirtyFrom = 0, dirtyTo = 0;
+    int uploadsThisFrame = 0;
+    int uploadsLastFrame = 0;
+
+    void markSpritesDirty(int from, int to);
 
     float zoom, scroll;
 
-    GLuint verticesId;
+    // Sprite VBO pool - sprite i lives in chunk i / SPRITES_PER_CHUNK
+    QVector<GLuint> spriteChunks;
+    QVector<GLint> chunkFirsts;
+    QVector<GLsizei> chunkCounts;
+
+    void addSpriteChunk();
+
+    // A run of sprites drawn by strokes, and where compaction moves it to
+    struct SpriteRange
+    {
+        int from, to, newFrom;
+    };
+
+    static bool spriteRangeLessThan(const SpriteRange &r1, const SpriteRange &r2);
+
+    QVector<PenStroke*> findLiveStrokes();
+    QVector<SpriteRange> findLiveSpriteRanges(const QVector<PenStroke*> &strokes);
+    static int mapSpriteIndex(const QVector<SpriteRange> &ranges, int idx);
+
+    // Set by compactSprites() - the chunks past the packed sprites go with the next upload
+    bool spareChunksPending = false;
+    void releaseSpareSpriteChunks();
+    void drawSpriteRanges(const GLint* firsts, const GLsizei* counts, int n, bool withStyle);
+    void submitChunkRanges(GLenum mode);
+
+    // Capsule segments - segment i is stored as vertices [i * 6, i * 6 + 6)
+    QVector<SegmentVertex> segmentVertices;
+    GLuint segmentsId;
+    int segmentCapacity = 0;
+    int segmentsUploaded = 0;
+
+    void uploadPendingSegments();
+
+    static bool segStartLessThan(PenStroke* s1, PenStroke* s2);
+
     GLuint rectId;
 
     Shader strokeShader;
     Shader pickingShader;
     Shader selectionRectShader;
     Shader canvasShader;
+    Shader batchShader;
+    Shader capsuleShader;
+
+    // Stroke ranges waiting for flushStrokeBatch(), grouped in runs that share the same transform and geometry
+    struct BatchRun
+    {
+        QMatrix4x4 transform;
+        bool segments;
+        int firstRange, rangeCount;
+        BatchRun() {}
+        BatchRun(const QMatrix4x4 &transform, bool segments, int firstRange) :
+            transform(transform), segments(segments), firstRange(firstRange), rangeCount(0) {}
+    };
+    QVector<BatchRun> batchRuns;
+    QVector<GLint> batchFirsts;
+    QVector<GLsizei> batchCounts;
+
+    void queueStrokeRange(int from, int to, const QMatrix4x4 &transform, bool segments);
+    void drawBatchRuns();
+    void setBatchTarget(float zoom, float scroll, float width, float height);
+    float batchTargetWidth = 0;
+    void clearBatch();
 
     QPointF canvasSize;
 
@@ -43,11 +132,19 @@ class StrokeRenderer : protected OPENGL_FUNCTIONS
     float normalSizeAdjustment = 1.0f / 542.0f;
     float pickingSizeAdjustment = 5.0f;
 
+    // Picking readback in flight - the picked pixel is copied to pickingPixelBuffer and read once pickingFence signals
+    GLuint pickingPixelBuffer = 0;
+    void* pickingFence = NULL;
+    QPointF pickingPos;
+
 public:
     StrokeRenderer();
 
     static StrokeRenderer* si;
 
+    // Every GL state change of the StrokeRenderer goes through it
+    GLState glState;
+
     void windowSizeChanged(int width, int height);
 
     void init();
@@ -56,11 +153,65 @@ public:
     int addPoint(const QPointF &strokePoint);
 
     void processPicking();
+    void pollPicking();
+
+    bool pickingPending = false;
+
+    float getPickingRadius(float ptSize);
+
+    // Culling only applies to picking, which renders the screen - the atlas holds the whole page, and tiles aren't
+    // drawn one at a time, so everything on the page is in it
+    bool isInRenderTarget(const QRectF &rect);
+
+    // The rows isInRenderTarget lets through, in SHRT units
+    void getRenderTargetRange(float &visibleTop, float &visibleBottom);
 
     void renderSelectionRect(QRectF rect);
 
     void addStrokeSprite(float x, float y);
 
+    void setSpriteStyle(float r, float g, float b, float ptSize);
+
+    enum {SPRITE_RENDERING, QUAD_RENDERING};
+    int renderingMode = QUAD_RENDERING;
+    void setRenderingMode(int mode);
+    bool drawsSegments();
+
+    // Rendering the ID colors on the GPU - the gpuPicking setting. It needs the sprites
+    bool gpuPicking = false;
+
+    // Sprites are only made while something draws them: in sprite mode, or for GPU picking. Quads just need the
+    // subevents, and the sprites are generated again for the whole lecture when they are needed back
+    bool spritesEnabled = true;
+
+    // firstLine marks the segment after the stroke's start dot, which already covers the first half spacing
+    int addStrokeSegment(float x0, float y0, float x1, float y1, float r, float g, float b, float ptSize, bool firstLine);
+    int getSegmentCount();
+
+    // Segments no stroke of the lecture or the clipboard draws anymore, from 0 to 1 - cloned and trimmed strokes
+    // make theirs again at the end of the buffer
+    float getDeadSegmentRatio();
+
+    // Pack the segments of the strokes of the lecture and the clipboard at the start of the buffer and move the
+    // strokes' segStart along. Returns the segments reclaimed
+    int compactSegments();
+
+    // Drop every segment, once no stroke is left to draw them. The buffer is reallocated with the next upload
+    void clearSegments();
+
+    void uploadPendingSprites();
+    int getUploadsLastFrame();
+
+    // Throw every sprite away and make them again for the strokes among events, in parallel - the sprites of
+    // any other stroke are lost. They are uploaded by the next frame
+    void regenerateSprites(const QVector<Event*> &events);
+    SpritePoolStats getSpritePoolStats();
+
+    // Pack the sprites still drawn by the strokes of the lecture and the clipboard at the start of the buffer and
+    // move the strokes' indexes along - the rest is dropped. Returns the sprites reclaimed.
+    // Nothing may hold sprite indexes across the call, so not while a redraw is under way
+    int compactSprites();
+
     const float canvasRatio = 2.0f;
     const float canvasRatioSquared = canvasRatio * canvasRatio;
     float viewportYStart = 0;
@@ -72,7 +223,10 @@ public:
 
     int getCurrentSpriteCounter();
     void drawStrokeSpritesRange(int from, int to, float r, float g, float b, float ptSize, QMatrix4x4 transform, int ID);
-    void drawTexturedRect(float x, float y, float w, float h);
+    void drawStrokeSegmentsRange(int from, int to, QMatrix4x4 transform);
+    void flushStrokeBatch();
+    void flushStrokeBatchToScreen();
+    void drawTexturedRect(float x, float y, float w, float h, float t0 = 1.0f, float t1 = 0.0f);
     void setViewportYStart(float value);
     void drawCursor();
 };
@@ -0,0 +1,102 @@
+#include "subeventcolumns.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <qmath.h>
+
+static qint16 toShort(float value)
+{
+    return (qint16)qBound(SHRT_MIN, qRound(value), SHRT_MAX);
+}
+
+
+void SubeventColumns::append(int time, float px, float py)
+{
+    t << time;
+    x << toShort(px);
+    y << toShort(py);
+}
+
+
+void SubeventColumns::append(int time, float px, float py, int pb)
+{
+    append(time, px, py);
+
+    pbIdx << pb;
+}
+
+
+// Const access, so columns shared with a clone aren't detached
+int SubeventColumns::upperBound(int time) const
+{
+    const int* times = t.constData();
+
+    return std::upper_bound(times, times + t.size(), time) - times;
+}
+
+
+int SubeventColumns::lowerBound(int time) const
+{
+    const int* times = t.constData();
+
+    return std::lower_bound(times, times + t.size(), time) - times;
+}
+
+
+void SubeventColumns::remove(int from, int to)
+{
+    if (to <= from) return;
+
+    t.remove(from, to - from);
+    x.remove(from, to - from);
+    y.remove(from, to - from);
+
+    if (!pbIdx.isEmpty()) pbIdx.remove(from, to - from);
+}
+
+
+SubeventColumns SubeventColumns::mid(int from) const
+{
+    SubeventColumns columns;
+
+    columns.t = t.mid(from);
+    columns.x = x.mid(from);
+    columns.y = y.mid(from);
+
+    if (!pbIdx.isEmpty()) columns.pbIdx = pbIdx.mid(from);
+
+    return columns;
+}
+
+
+void SubeventColumns::shiftTimes(int shift)
+{
+    int* times = t.data();
+    int n = t.size();
+
+    for (int i = 0; i < n; i++) times[i] += shift;
+}
+
+
+void SubeventColumns::scaleTimes(float scale, int shift, int pivot)
+{
+    int* times = t.data();
+    int n = t.size();
+
+    for (int i = 0; i < n; i++) times[i] = (times[i] + shift - pivot) * scale + pivot;
+}
+
+
+void SubeventColumns::shiftPbIdx(int delta)
+{
+    int* indexes = pbIdx.data();
+    int n = pbIdx.size();
+
+    for (int i = 0; i < n; i++) indexes[i] += delta;
+}
+
+
+int SubeventColumns::getBytesUsed() const
+{
+    return t.capacity() * sizeof(int) + (x.capacity() + y.capacity()) * sizeof(qint16) + pbIdx.capacity() * sizeof(int);
+}
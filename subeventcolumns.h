@@ -0,0 +1,46 @@
+#ifndef SUBEVENTCOLUMNS_H
+#define SUBEVENTCOLUMNS_H
+
+#include <QVector>
+#include <QPointF>
+
+// Subevents of a stroke or pointer movement, a column per field. Time searches go through the times alone, and
+// passes over one field (timeShift, scaleAndMove, moving sprite indexes) are plain loops the compiler can vectorize.
+// Positions are kept in SHRT units as shorts, as in the video file and the segment vertices - 12 bytes per stroke
+// subevent instead of 16, 8 per pointer subevent instead of 12. Pointer movements leave pbIdx empty.
+class SubeventColumns
+{
+public:
+    QVector<int> t;
+    QVector<qint16> x, y;
+    QVector<int> pbIdx; // Sprite buffer index after the subevent's sprites
+
+    int size() const { return t.size(); }
+    bool isEmpty() const { return t.isEmpty(); }
+
+    QPointF pos(int i) const { return QPointF(x[i], y[i]); }
+
+    void append(int time, float px, float py);
+    void append(int time, float px, float py, int pb);
+
+    // Index of the first subevent later than time, or not earlier than time - the times are sorted
+    int upperBound(int time) const;
+    int lowerBound(int time) const;
+
+    // Erase the subevents [from, to)
+    void remove(int from, int to);
+
+    // The subevents from index from on
+    SubeventColumns mid(int from) const;
+
+    void shiftTimes(int shift);
+
+    // t = (t + shift - pivot) * scale + pivot, the way the events' start and end times are scaled
+    void scaleTimes(float scale, int shift, int pivot);
+
+    void shiftPbIdx(int delta);
+
+    int getBytesUsed() const;
+};
+
+#endif
@@ -7,6 +7,8 @@ void Timeline::paintEvent(QPaintEvent *event)
 {
     QPainter painter(this);
 
+    bool animating = false;
+
     timeCursorMSec = getCurrentTime();
 
     // Paint current event
@@ -22,31 +24,8 @@ void Timeline::paintEvent(QPaintEvent *event)
     // Draw timeline ruler
     windowEndMSec = windowStartMSec + width() * mSecsPerPixel ;
 
-    float firstMarkMSec = mSecsBetweenMarks * (windowStartMSec / mSecsBetweenMarks);
-    float lastMarkMSec = mSecsBetweenMarks * (windowEndMSec / mSecsBetweenMarks);
-
-    float markPos = (firstMarkMSec - windowStartMSec) * pixelsPerMSec;
-    for (float markTimeMSec = firstMarkMSec; markTimeMSec <= lastMarkMSec; markTimeMSec += mSecsBetweenMarks)
-    {
-        QString minutesAndSeconds;
-        minutesAndSeconds.sprintf( "%d:%02d", (int) markTimeMSec / 60000, ( (int) markTimeMSec % 60000 ) / 1000 );
-
-        // Draw ruler marks
-        painter.drawLine(markPos, height(), markPos, height()-16);
-
-        // Draw timestamps
-        painter.drawText(markPos+3, height()-6, minutesAndSeconds);
-
-        for (float subdivisionPos = markPos + pixelsPerSubmark;
-                   subdivisionPos < markPos + pixelsPerMark;
-                   subdivisionPos += pixelsPerSubmark)
-        {
-            // draw ruler submarks
-            painter.drawLine(subdivisionPos, height(), subdivisionPos, height()-4);
-        }
-
-        markPos += pixelsPerMark;
-    }
+    updateRulerLayer();
+    painter.drawPixmap(QPointF((rulerStartMSec - windowStartMSec) * pixelsPerMSec, 0), rulerLayer);
 
     // Get video pixmap source and target coords
     QRectF videoTimelineTarget(0,                videoTimelineStart, width(), videoTimelineHeight);
@@ -56,9 +35,12 @@ void Timeline::paintEvent(QPaintEvent *event)
     QRectF audioTimelineTarget(0,                audioTimelineStart, width(), audioTimelineHeight);
     QRectF audioTimelineSource(timelineStartPos, 0,                  width(), audioPixmapHeight);
 
-    // Draw both video and audio pixmaps
-    painter.drawPixmap(videoTimelineTarget, *videoPixmap, videoTimelineSource);
-    painter.drawPixmap(audioTimelineTarget, *audioPixmap, audioTimelineSource);
+    // Draw both video and audio pixmaps - until something is drawn into them they would be blank
+    if (videoPixmap) painter.drawPixmap(videoTimelineTarget, *videoPixmap, videoTimelineSource);
+    else painter.fillRect(videoTimelineTarget, timelineColor);
+
+    if (audioPixmap) painter.drawPixmap(audioTimelineTarget, *audioPixmap, audioTimelineSource);
+    else painter.fillRect(audioTimelineTarget, timelineColor);
 
     // Start selection painting
     if (videoSelected)
@@ -88,17 +70,12 @@ void Timeline::paintEvent(QPaintEvent *event)
             videoLeftScaleArrow =  QPolygon(scaleArrowLeft.translated( videoSelectionRect.left(),      videoTimelineStart));
             videoRightScaleArrow = QPolygon(scaleArrowRight.translated(videoSelectionRect.right() + 1, videoTimelineStart));
 
-            if ( (videoSelectionRect.contains(mousePos) ||
-                  videoLeftScaleArrow.containsPoint(mousePos, Qt::OddEvenFill) ||
-                  videoRightScaleArrow.containsPoint(mousePos, Qt::OddEvenFill)) &&
-                 !(draggingEvents || scalingEventsLeft || scalingEventsRight || !mouseOver) )
-            {
-                videoScaleArrowAlpha += (targetAlpha - videoScaleArrowAlpha) * arrowFadeIn;
-            }
-            else
-            {
-                videoScaleArrowAlpha -= videoScaleArrowAlpha * arrowFadeOut;
-            }
+            bool arrowsVisible = (videoSelectionRect.contains(mousePos) ||
+                                  videoLeftScaleArrow.containsPoint(mousePos, Qt::OddEvenFill) ||
+                                  videoRightScaleArrow.containsPoint(mousePos, Qt::OddEvenFill)) &&
+                                 !(draggingEvents || scalingEventsLeft || scalingEventsRight || !mouseOver);
+
+            if ( fadeArrows(videoScaleArrowAlpha, arrowsVisible) ) animating = true;
 
             QColor selectionColorArrow = selectionColor;
             selectionColorArrow.setAlpha(videoScaleArrowAlpha);
@@ -136,17 +113,12 @@ void Timeline::paintEvent(QPaintEvent *event)
             audioLeftScaleArrow =  QPolygon(scaleArrowLeft.translated( audioSelectionRect.left(),      audioTimelineStart));
             audioRightScaleArrow = QPolygon(scaleArrowRight.translated(audioSelectionRect.right() + 1, audioTimelineStart));
 
-            if ( (audioSelectionRect.contains(mousePos) ||
-                  audioLeftScaleArrow.containsPoint(mousePos, Qt::OddEvenFill) ||
-                  audioRightScaleArrow.containsPoint(mousePos, Qt::OddEvenFill)) &&
-                 !(draggingEvents || scalingEventsLeft || scalingEventsRight || !mouseOver) )
-            {
-                audioScaleArrowAlpha += (targetAlpha - audioScaleArrowAlpha) * arrowFadeIn;
-            }
-            else
-            {
-                audioScaleArrowAlpha -= audioScaleArrowAlpha * arrowFadeOut;
-            }
+            bool arrowsVisible = (audioSelectionRect.contains(mousePos) ||
+                                  audioLeftScaleArrow.containsPoint(mousePos, Qt::OddEvenFill) ||
+                                  audioRightScaleArrow.containsPoint(mousePos, Qt::OddEvenFill)) &&
+                                 !(draggingEvents || scalingEventsLeft || scalingEventsRight || !mouseOver);
+
+            if ( fadeArrows(audioScaleArrowAlpha, arrowsVisible) ) animating = true;
 
             QColor selectionColorArrow = selectionColor;
             selectionColorArrow.setAlpha(audioScaleArrowAlpha);
@@ -173,16 +145,85 @@ void Timeline::paintEvent(QPaintEvent *event)
     painter.setRenderHint(QPainter::Antialiasing, false);
     painter.drawLine((int)cursorPos, 0, (int)cursorPos, height());
 
-    if (!MainWindow::si->childWindowOpen) update();
+    // Only keep repainting while something is moving - playback and recording are driven by the canvas frame clock
+    if (animating) update();
 
     // Stop playing if end of file is reached
     if (timeCursorMSec > totalTimeRecorded && isPlaying) MainWindow::si->stopPlaying();
 }
 
 
+// Move the scale arrows alpha towards shown or hidden - returns whether it's still fading
+bool Timeline::fadeArrows(float &alpha, bool visible)
+{
+    if (visible)
+    {
+        alpha += (targetAlpha - alpha) * arrowFadeIn;
+
+        if (targetAlpha - alpha > 0.5f) return true;
+
+        alpha = targetAlpha;
+    }
+    else
+    {
+        alpha -= alpha * arrowFadeOut;
+
+        if (alpha > 0.5f) return true;
+
+        alpha = 0;
+    }
+
+    return false;
+}
+
+
+// Ruler marks and timestamps, prerendered for a few marks around the window - rebuilt only when the window leaves it
+void Timeline::updateRulerLayer()
+{
+    if (rulerLayer.height() == height() && rulerPixelsPerMSec == pixelsPerMSec &&
+        windowStartMSec >= rulerStartMSec && windowEndMSec <= rulerEndMSec) return;
+
+    // Start one mark before the window, so scrolling back a little doesn't rebuild it
+    rulerStartMSec = std::max(0, mSecsBetweenMarks * (windowStartMSec / mSecsBetweenMarks - 1));
+
+    int marks = width() / pixelsPerMark + 3;
+    rulerEndMSec = rulerStartMSec + marks * mSecsBetweenMarks;
+    rulerPixelsPerMSec = pixelsPerMSec;
+
+    rulerLayer = QPixmap(marks * pixelsPerMark + 1, height());
+    rulerLayer.fill(Qt::transparent);
+
+    QPainter painter(&rulerLayer);
+    painter.setFont(font());
+
+    float markPos = 0;
+    for (int markTimeMSec = rulerStartMSec; markTimeMSec < rulerEndMSec; markTimeMSec += mSecsBetweenMarks)
+    {
+        QString minutesAndSeconds;
+        minutesAndSeconds.sprintf( "%d:%02d", markTimeMSec / 60000, ( markTimeMSec % 60000 ) / 1000 );
+
+        // Draw ruler marks
+        painter.drawLine(markPos, height(), markPos, height()-16);
+
+        // Draw timestamps
+        painter.drawText(markPos+3, height()-6, minutesAndSeconds);
+
+        for (float subdivisionPos = markPos + pixelsPerSubmark;
+                   subdivisionPos < markPos + pixelsPerMark;
+                   subdivisionPos += pixelsPerSubmark)
+        {
+            // draw ruler submarks
+            painter.drawLine(subdivisionPos, height(), subdivisionPos, height()-4);
+        }
+
+        markPos += pixelsPerMark;
+    }
+}
+
+
 void Timeline::paintVideoPixmap()
 {
-    QPainter painter(videoPixmap);
+    QPainter painter(getVideoPixmap());
 
     int x1 = currentEvent->startTime * pixelsPerMSec;
     int x2;
@@ -362,6 +403,12 @@ void Timeline::deleteVideo(int fromTime, int toTime)
 
     int deleteSelectionEndIdx = i - events.begin() - 1;
 
+    // The event before the selection may get trimmed
+    invalidateFrom(deleteSelectionStartIdx - 1);
+
+    // Whatever is trimmed or deleted lies inside what the events covered before
+    damageEvents(deleteSelectionStartIdx - 1, deleteSelectionEndIdx + 2);
+
 //    if (deleteSelectionEndIdx < deleteSelectionStartIdx) return;
 //    if (deleteSelectionEndIdx == events.size() || deleteSelectionStartIdx > deleteSelectionEndIdx || deleteSelectionStartIdx == -1)
 //    {
@@ -382,6 +429,12 @@ void Timeline::deleteVideo(int fromTime, int toTime)
         {
             events[deleteSelectionStartIdx - 1]->trimRange(fromTime, toTime, deleteSelectionStartIdx, events);
 
+            spatialIndex.rebuild(events);
+
+            updateDrawResumePoint();
+
+            Canvas::si->scheduleSpriteCompaction();
+
             return;
         }
     }
@@ -408,15 +461,26 @@ void Timeline::deleteVideo(int fromTime, int toTime)
 //        }
     }
 
-    //TODO: delete
+    QVector<Event*> deleted = events.mid(deleteSelectionStartIdx, deleteSelectionEndIdx + 1 - deleteSelectionStartIdx);
+
     events.erase(events.begin() + deleteSelectionStartIdx, events.begin() + deleteSelectionEndIdx + 1);
 
-    Canvas::si->redrawRequested = true;
+    // What was cut lives on in the clipboard as clones, so nothing else refers to these
+    if (deleted.contains(currentEvent)) currentEvent = NULL;
+
+    qDeleteAll(deleted);
+
+    spatialIndex.rebuild(events);
+
+    updateDrawResumePoint();
+
+    // Unless they were cut to the clipboard, the sprites of the deleted strokes aren't drawn anymore
+    Canvas::si->scheduleSpriteCompaction();
 
     int x1 = fromTime * pixelsPerMSec - 1;
     int x2 = toTime   * pixelsPerMSec + 1;
 
-    QPainter painter(videoPixmap);
+    QPainter painter(getVideoPixmap());
     painter.fillRect(x1, 0, x2-x1, videoPixmapHeight, timelineColor);
 }
 
@@ -428,16 +492,16 @@ void Timeline::deleteAudio(int fromTime, int toTime)//TODO
     QByteArray zeros(deletionSizeBytes, 0);
 
     // Write zeros to the specified range
-    int oldSeekPos = rawAudioFile->pos();
-    rawAudioFile->seek(selectionStart);
-    while (deletionSizeBytes != 0) deletionSizeBytes -= rawAudioFile->write(zeros);
-    rawAudioFile->seek(oldSeekPos);
+    int oldSeekPos = getRawAudioFile()->pos();
+    getRawAudioFile()->seek(selectionStart);
+    while (deletionSizeBytes != 0) deletionSizeBytes -= getRawAudioFile()->write(zeros);
+    getRawAudioFile()->seek(oldSeekPos);
 
     // Erase the specified range of the audio pixmap
     int x1 = lastSelectionStartPos - 1;
     int x2 = lastSelectionEndPos + 1;
 
-    QPainter painter(audioPixmap);
+    QPainter painter(getAudioPixmap());
     painter.fillRect(x1, 0, x2-x1, audioPixmapHeight, timelineColor);
 }
 
@@ -496,12 +560,15 @@ void Timeline::scaleAndMoveSelectedAudio()
 void Timeline::copyVideo()
 {
     // Copy the selected video pixmap
-    tmpVideo = videoPixmap->copy(selectionStartPos + 1, 0,
-                                 selectionEndPos - selectionStartPos - 1, videoPixmapHeight);
+    tmpVideo = getVideoPixmap()->copy(selectionStartPos + 1, 0,
+                                      selectionEndPos - selectionStartPos - 1, videoPixmapHeight);
 
-    // Empty clipboard
+    // Empty clipboard - the sprites of what was cut and not pasted are dead now
+    qDeleteAll(eventsClipboard);
     eventsClipboard.clear();
 
+    Canvas::si->scheduleSpriteCompaction();
+
     // Clone the selected events and move their clones to the clipboard
     for (int i = selectionStartIdx; i <= selectionEndIdx; i++)
     {
@@ -513,8 +580,8 @@ void Timeline::copyVideo()
 void Timeline::copyAudio()
 {
     // Copy the selected audio pixmap
-    tmpAudio = audioPixmap->copy(selectionStartPos + 1, 0,
-                                 selectionEndPos - selectionStartPos - 1, audioPixmapHeight);
+    tmpAudio = getAudioPixmap()->copy(selectionStartPos + 1, 0,
+                                      selectionEndPos - selectionStartPos - 1, audioPixmapHeight);
 
     // Empty clipboard
     audioClipboard.clear();
@@ -526,15 +593,15 @@ void Timeline::copyAudio()
     QByteArray tmpArray;
 
     // Fill audioClipboard with selection
-    int oldSeekPos = rawAudioFile->pos();
-    rawAudioFile->seek(selectionStart);
+    int oldSeekPos = getRawAudioFile()->pos();
+    getRawAudioFile()->seek(selectionStart);
     while (bytesToRead != 0)
     {
-        tmpArray = rawAudioFile->read(bytesToRead);
+        tmpArray = getRawAudioFile()->read(bytesToRead);
         bytesToRead -= tmpArray.size();
         audioClipboard.append(tmpArray);
     }
-    rawAudioFile->seek(oldSeekPos);
+    getRawAudioFile()->seek(oldSeekPos);
 
     // Reset variables
     audioSelectionStart = selectionStartTime;
@@ -570,14 +637,20 @@ void Timeline::pasteVideo()
     int insertIdx = qLowerBound(events.begin(), events.end(), &value, startTimeLessThan) - events.begin();
 
     // Paste pixmap
-    QPainter painter(videoPixmap);
+    QPainter painter(getVideoPixmap());
     painter.drawPixmap(atTimeMSec * pixelsPerMSec, 0, timeLength * pixelsPerMSec, videoPixmapHeight, tmpVideo);
 
 //    QVector<Event*> newEvents(events.size() + eventsClipboard.size());
 
     events = events.mid(0, insertIdx) + eventsClipboard + events.mid(insertIdx); //TODO - improve performance
 
-    Canvas::si->redrawRequested = true;
+    invalidateFrom(insertIdx);
+
+    spatialIndex.rebuild(events);
+
+    damageEvents(insertIdx, insertIdx + eventsClipboard.size());
+
+    updateDrawResumePoint();
 
     eventsClipboard.clear();
 }
@@ -586,17 +659,17 @@ void Timeline::pasteVideo()
 void Timeline::pasteAudio()
 {
     // Paste pixmap
-    QPainter painter(audioPixmap);
+    QPainter painter(getAudioPixmap());
     painter.drawPixmap(audioSelectionStart * pixelsPerMSec, 0, audioSelectionSize * pixelsPerMSec, audioPixmapHeight, tmpAudio);
 
     int pasteSizeBytes = audioClipboard.size();
     int selectionStart = sampleSize * samplingFrequency * audioSelectionStart / 1000.0;
 
     // Write clipboard's content to the audio file
-    int oldSeekPos = rawAudioFile->pos();
-    rawAudioFile->seek(selectionStart);
-    while (pasteSizeBytes != 0) pasteSizeBytes -= rawAudioFile->write(audioClipboard);
-    rawAudioFile->seek(oldSeekPos);
+    int oldSeekPos = getRawAudioFile()->pos();
+    getRawAudioFile()->seek(selectionStart);
+    while (pasteSizeBytes != 0) pasteSizeBytes -= getRawAudioFile()->write(audioClipboard);
+    getRawAudioFile()->seek(oldSeekPos);
 
     audioClipboard.clear();
 }
@@ -663,6 +736,8 @@ void Timeline::unselect()
 {
     videoSelected = false;
     audioSelected = false;
+
+    update();
 }
 
 
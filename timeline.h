@@ -10,6 +10,8 @@
 #include <QThread>
 
 #include "events.h"
+#include "spatialindex.h"
+#include "drawlist.h"
 
 #if QT_VERSION < 0x050000
     #define setSampleRate(sr) setFrequency(sr);
@@ -24,6 +26,24 @@ class PlayerThread : public QThread
     void run();
 };
 
+// Looks up the audio devices and their formats off the GUI thread - the backends can take seconds to enumerate them
+class AudioProbeThread : public QThread
+{
+    Q_OBJECT
+    void run();
+
+public:
+    // Set before start - an empty name picks the default device
+    QString inputDeviceName;
+    QString outputDeviceName;
+
+    // The requested format going in, the one both devices support coming out
+    QAudioFormat format;
+
+    QAudioDeviceInfo infoIn;
+    QAudioDeviceInfo infoOut;
+};
+
 struct chunk
 {
     char        id[4];
@@ -121,6 +141,14 @@ class Timeline : public QWidget
     // Handle dragging and scaling both video and audio
     bool handleSelectionPressed(QRect &selectionRect, QPolygon &leftArrow, QPolygon &rightArrow);
 
+    bool fadeArrows(float &alpha, bool visible);
+
+    // Prerendered time ruler
+    QPixmap rulerLayer;
+    int rulerStartMSec = 0, rulerEndMSec = 0;
+    double rulerPixelsPerMSec = 0;
+    void updateRulerLayer();
+
     // Timeline sizing and positioning
     const int videoTimelineStart = 0;
     const int videoTimelineHeight = 34;
@@ -134,22 +162,27 @@ public:
 
     // Objects used for audio sampling
     PlayerThread playerThread;
+    AudioProbeThread audioProbeThread;
     QAudioFormat format;
     QAudioDeviceInfo infoIn;
     QAudioDeviceInfo infoOut;
-    QAudioInput *audioInput;
-    QAudioOutput *audioOutput;
+    QAudioInput *audioInput = NULL; // NULL until the devices have been probed
+    QAudioOutput *audioOutput = NULL;
     QIODevice* inputDevice;
     QByteArray audioTempBuffer;
 
-    // Final output file
+    // Final output file - opened and truncated on first use
     QFile* rawAudioFile;
+    QFile* getRawAudioFile();
 
-    // The 2 main parts of the timeline, where audio and video events are displayed, respectively
-    QPixmap* audioPixmap;
-    QPixmap* videoPixmap;
+    // The 2 main parts of the timeline, where audio and video events are displayed, respectively.
+    // Both are pixmapLenght wide, so they are only allocated once something is drawn into them
+    QPixmap* audioPixmap = NULL;
+    QPixmap* videoPixmap = NULL;
+    QPixmap* getAudioPixmap();
+    QPixmap* getVideoPixmap();
 
-    // Setup all audio objects initialization
+    // Setup all audio objects initialization - the devices are probed on audioProbeThread
     void initializeAudio();
 
     // Audio variables
@@ -175,6 +208,9 @@ public:
 
     // The vector of events
     QVector<Event*> events;
+
+    // Strokes by position on the canvas - used for picking
+    SpatialIndex spatialIndex;
     QVector<Event*> eventsClipboard;
 
     // Currently active Event - the one being filled
@@ -185,6 +221,16 @@ public:
     int eventToDrawIdx = 0;
     int lastDrawnSubeventIndex = 0;
 
+    // Used to resume a redraw
+    int redrawDoneTime = 0;
+    bool redrawUseKeyframes = false;
+
+    // What the redraw draws of each event, built once when it begins - the budgeted frames go through it
+    DrawList redrawList;
+
+    // Events from eventIdx on were edited - drop the keyframes that show them and the redraw list worked out from them
+    void invalidateFrom(int eventIdx);
+
     // Draw the video part of the timeline
     void paintVideoPixmap();
 
@@ -245,6 +291,24 @@ public:
     // Redraw screen until time cursor position
     void redrawScreen();
 
+    // The same redraw spread over several frames: beginRedraw, then continueRedraw every frame until it returns true
+    void beginRedraw();
+    // budgetPrimitives counts segments with quads, sprites otherwise
+    bool continueRedraw(int budgetMSec, int budgetPrimitives);
+
+    // A redraw was begun and hasn't reached the time cursor yet
+    bool redrawing = false;
+
+    // Draw until the time cursor only the strokes that touch rect (SHRT units) - the canvas clips to it
+    void redrawRegion(const QRectF &rect);
+
+    // Where a full redraw would stop, for the incremental draw to carry on from - after events were added or removed.
+    // Relies on events being sorted by endTime without overlapping. Restarts a redraw in progress instead
+    void updateDrawResumePoint();
+
+    // Redraw the part of the canvas covered by the events in [from, to) drawn by the time cursor
+    void damageEvents(int from, int to);
+
     // Just draw what changed in the screen
     void incrementalDraw();
 
@@ -264,6 +328,9 @@ public:
 
     void exportVideo();
 
+    // False if it couldn't be read - the current lecture is then kept
+    bool loadVideo(const QString &fileName);
+
     void startMic();
 
     // Write wav header
@@ -291,6 +358,9 @@ public slots:
 
     // Read samples from microphone, paint the audioline and output to the audio file
     void readAudioFromMic();
+
+    // Create the audio input and output once audioProbeThread is done
+    void audioDevicesProbed();
 };
 
 #endif
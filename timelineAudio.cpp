@@ -1,4 +1,5 @@
 #include "timeline.h"
+#include "startuptimer.h"
 
 Timeline* Timeline::si;
 
@@ -7,14 +8,6 @@ Timeline::Timeline(QWidget *parent) :
 {
     si = this;
 
-    // Create audio pixmap
-    audioPixmap = new QPixmap(pixmapLenght, audioPixmapHeight);
-    audioPixmap->fill(timelineColor);
-
-    // Create video pixmap
-    videoPixmap = new QPixmap(pixmapLenght, 1);
-    videoPixmap->fill(timelineColor);
-
     // Create arrows for timeline
     pointerTriangle << QPoint(-5, 1)   << QPoint( 5,  1)                   << QPoint(  0, -4);
     scaleArrowLeft  << QPoint( 0, 0)   << QPoint( 0,  videoTimelineHeight) << QPoint(-18,  videoTimelineHeight/2);
@@ -24,13 +17,12 @@ Timeline::Timeline(QWidget *parent) :
     setContextMenuPolicy(Qt::CustomContextMenu);
     connect(this, SIGNAL(customContextMenuRequested(const QPoint&)),this, SLOT(ShowContextMenu(const QPoint&)));
 
-    // Create and open audio file
+    // Create audio file - getRawAudioFile opens it
     #ifndef Q_OS_MAC
     rawAudioFile = new QFile("rawAudioFile.wav");
     #else
     rawAudioFile = new QFile("./../../../rawAudioFile.raw");
     #endif
-    rawAudioFile->open(QIODevice::ReadWrite | QIODevice::Truncate);
 
     initializeAudio();
 }
@@ -41,6 +33,19 @@ Timeline::~Timeline()
     // Export video
     exportVideo();
 
+    // Delete audio objects
+    audioProbeThread.wait();
+
+    if (audioInput) audioInput->stop();
+    if (audioOutput) audioOutput->stop();
+
+    // Nothing was recorded if the audio file was never opened
+    if (!rawAudioFile->isOpen())
+    {
+        Event::deleteAllEvents();
+        return;
+    }
+
     // Export audio
     writeWavHeader(rawAudioFile);
     rawAudioFile->close();
@@ -82,10 +87,38 @@ Timeline::~Timeline()
     }
     // Delete event objects
     Event::deleteAllEvents();
+}
 
-    // Delete audio objects
-    audioInput->stop();
-    audioOutput->stop();
+
+QFile* Timeline::getRawAudioFile()
+{
+    if (!rawAudioFile->isOpen()) rawAudioFile->open(QIODevice::ReadWrite | QIODevice::Truncate);
+
+    return rawAudioFile;
+}
+
+
+QPixmap* Timeline::getAudioPixmap()
+{
+    if (!audioPixmap)
+    {
+        audioPixmap = new QPixmap(pixmapLenght, audioPixmapHeight);
+        audioPixmap->fill(timelineColor);
+    }
+
+    return audioPixmap;
+}
+
+
+QPixmap* Timeline::getVideoPixmap()
+{
+    if (!videoPixmap)
+    {
+        videoPixmap = new QPixmap(pixmapLenght, videoPixmapHeight);
+        videoPixmap->fill(timelineColor);
+    }
+
+    return videoPixmap;
 }
 
 
@@ -100,12 +133,28 @@ void Timeline::initializeAudio()
     format.setCodec("audio/pcm");
 
 
+    // Probe the devices in the background - the window shows up meanwhile, with the rec and play buttons disabled
+    // until audioDevicesProbed
+    QSettings settings;
+
+    audioProbeThread.inputDeviceName = settings.value("audioInputDevice").toString();
+    audioProbeThread.outputDeviceName = settings.value("audioOutputDevice").toString();
+    audioProbeThread.format = format;
+
+    connect(&audioProbeThread, SIGNAL(finished()), this, SLOT(audioDevicesProbed()));
+
+    audioProbeThread.start();
+}
+
+
+void AudioProbeThread::run()
+{
     // Get input device information
-    if(QSettings().value("audioInputDevice").isValid())
+    if (!inputDeviceName.isEmpty())
     {
         for(const QAudioDeviceInfo& deviceInfo : QAudioDeviceInfo::availableDevices(QAudio::AudioInput))
         {
-             if (deviceInfo.deviceName() == QSettings().value("audioInputDevice").toString())
+             if (deviceInfo.deviceName() == inputDeviceName)
              {
                  infoIn = deviceInfo;
              }
@@ -118,11 +167,11 @@ void Timeline::initializeAudio()
 
 
     // Get output device information
-    if(QSettings().value("audioOutputDevice").isValid())
+    if (!outputDeviceName.isEmpty())
     {
         for(const QAudioDeviceInfo& deviceInfo : QAudioDeviceInfo::availableDevices(QAudio::AudioOutput))
         {
-             if (deviceInfo.deviceName() == QSettings().value("audioOutputDevice").toString())
+             if (deviceInfo.deviceName() == outputDeviceName)
              {
                  infoOut = deviceInfo;
              }
@@ -134,11 +183,6 @@ void Timeline::initializeAudio()
     }
 
 
-    // Log devices actually being used
-    qDebug() << "Using audio input device: " + infoIn.deviceName();
-    qDebug() << "Using audio output device: " + infoOut.deviceName();
-
-
     // Get final input format
     if (!infoIn.isFormatSupported(format))
     {
@@ -146,12 +190,10 @@ void Timeline::initializeAudio()
        format = infoIn.nearestFormat(format);
 
        if (format.sampleSize() % 8 != 0) format.setSampleSize(8);
-       sampleSize = format.sampleSize() / 8;
-       samplingFrequency = format.sampleRate();
 
        qWarning() << "Audio Input: Requested format not supported. Getting the nearest:";
-       qWarning() << "Sample rate:" << samplingFrequency << "samples / second";
-       qWarning() << "Sample size:" << sampleSize << "bytes / sample";
+       qWarning() << "Sample rate:" << format.sampleRate() << "samples / second";
+       qWarning() << "Sample size:" << format.sampleSize() / 8 << "bytes / sample";
        qWarning() << "Sample type:" << format.sampleType();
        qWarning() << "Byte order: " << format.byteOrder();
     }
@@ -164,13 +206,27 @@ void Timeline::initializeAudio()
        format = infoOut.nearestFormat(format);
 
        if (format.sampleSize() % 8 != 0) format.setSampleSize(8);
-       sampleSize = format.sampleSize() / 8;
-       samplingFrequency = format.sampleRate();
 
        qWarning() << "Audio Output: Requested format not supported. Getting the nearest:";
-       qWarning() << "Sample rate:" << samplingFrequency << "samples / second";
-       qWarning() << "Sample size:" << sampleSize << "bytes / sample";
+       qWarning() << "Sample rate:" << format.sampleRate() << "samples / second";
+       qWarning() << "Sample size:" << format.sampleSize() / 8 << "bytes / sample";
     }
+}
+
+
+void Timeline::audioDevicesProbed()
+{
+    infoIn = audioProbeThread.infoIn;
+    infoOut = audioProbeThread.infoOut;
+    format = audioProbeThread.format;
+
+    sampleSize = format.sampleSize() / 8;
+    samplingFrequency = format.sampleRate();
+
+
+    // Log devices actually being used
+    qDebug() << "Using audio input device: " + infoIn.deviceName();
+    qDebug() << "Using audio output device: " + infoOut.deviceName();
 
 
     // Create audio input and output
@@ -185,6 +241,11 @@ void Timeline::initializeAudio()
 
     // Start audio capture device and connect to apropriate SLOTs
     startMic();
+
+    // Until now, recording would have timed strokes with the requested format and lost the audio
+    MainWindow::si->enableAudioButtons();
+
+    StartupTimer::mark("audio devices ready");
 }
 
 
@@ -205,18 +266,20 @@ void Timeline::startRecording()
 //        seekPos = rawAudioFile->size();
 //        timeCursorMSec = seekPos / (sampleSize * samplingFrequency / 1000.0);
 //    }
-    int seekPos = rawAudioFile->size();
+    int seekPos = getRawAudioFile()->size();
     timeCursorMSec = seekPos / (sampleSize * samplingFrequency / 1000.0);
 
     lastRecordStartLocalTime = timeCursorMSec;
     barCursor = timeCursorMSec * barsPerMSec;
     lastAudioPixelX = floor(barCursor);
-    rawAudioFile->seek(seekPos);
+    getRawAudioFile()->seek(seekPos);
     isRecording = true;
 
     timer.start();
 
-    Canvas::si->redrawRequested = true;
+    Canvas::si->startFrameClock();
+
+    Canvas::si->requestRedraw();
 }
 
 
@@ -226,19 +289,21 @@ void Timeline::pauseRecording()
 
     isRecording = false;
 
+    Canvas::si->stopFrameClock();
+
     // Update video upper limit
-    if (rawAudioFile->size() != 0)
-        totalTimeRecorded = rawAudioFile->size() / sampleSize / samplingFrequency * 1000.0;
+    if (getRawAudioFile()->size() != 0)
+        totalTimeRecorded = getRawAudioFile()->size() / sampleSize / samplingFrequency * 1000.0;
     else
         totalTimeRecorded = timeCursorMSec;
 
     // Fill the 1-2 pixels gap after recording to the middle of an existing audio piece
-    if (rawAudioFile->pos() != rawAudioFile->size())
+    if (getRawAudioFile()->pos() != getRawAudioFile()->size())
     {
         float x = barCursor * pixelsPerBar - 1;
-        QPixmap tmpPixmap = audioPixmap->copy(x, 0, 1, audioPixmapHeight);
+        QPixmap tmpPixmap = getAudioPixmap()->copy(x, 0, 1, audioPixmapHeight);
 
-        QPainter painter(audioPixmap);
+        QPainter painter(getAudioPixmap());
         painter.drawPixmap(x+1, 0, 2, audioPixmapHeight, tmpPixmap);
     }
 }
@@ -251,7 +316,7 @@ void Timeline::startPlaying()
     // Reset timecursor if the video is about to end
     if (timeCursorMSec > totalTimeRecorded - 100)
     {
-        rawAudioFile->seek(0);
+        getRawAudioFile()->seek(0);
         lastRecordStartLocalTime = 0;
         timeCursorMSec = 0;
     }
@@ -259,7 +324,7 @@ void Timeline::startPlaying()
     {
         int seekPos = sampleSize * samplingFrequency * timeCursorMSec / 1000.0;
         seekPos = (seekPos % 2 == 0) ? seekPos : seekPos - 1;
-        rawAudioFile->seek(seekPos);
+        getRawAudioFile()->seek(seekPos);
         lastRecordStartLocalTime = timeCursorMSec;
     }
 
@@ -267,7 +332,9 @@ void Timeline::startPlaying()
 
     playerThread.start();
 
-    Canvas::si->redrawRequested = true;
+    Canvas::si->startFrameClock();
+
+    Canvas::si->requestRedraw();
 }
 
 
@@ -276,6 +343,8 @@ void Timeline::stopPlaying()
     isPlaying = false;
 
     playerThread.exit();
+
+    Canvas::si->stopFrameClock();
 }
 
 void Timeline::readAudioFromMic()
@@ -291,7 +360,7 @@ void Timeline::readAudioFromMic()
 
     short* resultingData = (short*) audioTempBuffer.data(); //TODO: support char data (8bit samples)
 
-    QPainter painter(audioPixmap);
+    QPainter painter(getAudioPixmap());
     painter.setPen(QPen(audioColor));
 
     for (int i = 0; i < barsToAdd; i++)
@@ -317,7 +386,7 @@ void Timeline::readAudioFromMic()
 
     accumulatedSamples = totalSamplesRead + accumulatedSamples - barsToAdd * samplesPerBar;
 
-    rawAudioFile->write( audioTempBuffer, totalSamplesRead * sampleSize );
+    getRawAudioFile()->write( audioTempBuffer, totalSamplesRead * sampleSize );
 
 }
 
@@ -352,7 +421,7 @@ void PlayerThread::run()
 {
     QAudioOutput* audioOutput = new QAudioOutput(QAudioDeviceInfo::defaultOutputDevice(), Timeline::si->format);
 
-    audioOutput->start(Timeline::si->rawAudioFile);
+    audioOutput->start(Timeline::si->getRawAudioFile());
 
     QEventLoop loop;
     loop.exec();
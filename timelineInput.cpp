@@ -1,11 +1,21 @@
 #include "timeline.h"
 
 #include <QMenu>
+#include <QElapsedTimer>
+
+// 1 added the stroke size after its color
+#define VIDEO_FILE_VERSION 1
+
+// In timeline.cpp
+bool startTimeLessThan(const Event* e1, const Event* e2);
+bool endTimeLessThan(const Event* e1, const Event* e2);
 
 void Timeline::mousePressEvent(QMouseEvent *event)
 {
     mousePos = event->pos();
 
+    update();
+
     if(event->button() == Qt::MiddleButton)
     {
         mouseMiddleDown = true;
@@ -87,6 +97,8 @@ void Timeline::mouseMoveEvent(QMouseEvent *event)
 {
     mousePos = event->pos();
 
+    update();
+
     if(mouseMiddleDown)
     {
         windowStartMSec = lastWindowStartMSec + ( mouseDragStartX - event->x() ) * mSecsPerPixel;
@@ -150,6 +162,8 @@ void Timeline::mouseReleaseEvent(QMouseEvent *event)
 {
     mousePos = event->pos();
 
+    update();
+
     if(event->button() == Qt::MiddleButton)
     {
         mouseMiddleDown = false;
@@ -359,18 +373,24 @@ void Timeline::wheelEvent(QWheelEvent *event)
     windowStartMSec -= event->delta() * 8.0;
 
     if (windowStartMSec < 0) windowStartMSec = 0;
+
+    update();
 }
 
 
 void Timeline::enterEvent(QEvent *event)
 {
     mouseOver = true;
+
+    update();
 }
 
 
 void Timeline::leaveEvent(QEvent *event)
 {
     mouseOver = false;
+
+    update();
 }
 
 
@@ -381,7 +401,7 @@ void Timeline::setCursorAt(int x)
     if (timeCursorMSec > totalTimeRecorded) timeCursorMSec = totalTimeRecorded;
     if (timeCursorMSec < 0) timeCursorMSec = 0;
 
-    Canvas::si->redrawRequested = true;
+    Canvas::si->requestRedraw();
 }
 
 
@@ -466,26 +486,161 @@ void Timeline::ShowContextMenu(const QPoint& pos)
 // Redraw the entire screen from time 0 to the current timeCursor position
 void Timeline::redrawScreen()
 {
-    eventToDrawIdx = 0;
+    beginRedraw();
+    continueRedraw(0, 0);
+}
+
+
+void Timeline::beginRedraw()
+{
     Event::setSubeventIndex(0);
 
-    bool hitCursor = false;
+    // Picking draws to its own framebuffer, so keyframes of the canvas are of no use there
+    redrawUseKeyframes = !Canvas::si->pickingRequested;
 
-    for(; eventToDrawIdx < events.size(); eventToDrawIdx++)
+    // Start from the latest keyframe before the time cursor, if any - redrawDoneTime is when all drawn events ended
+    redrawDoneTime = 0;
+    eventToDrawIdx = redrawUseKeyframes ? Canvas::si->keyframes.restore(timeCursorMSec, redrawDoneTime) : 0;
+
+    redrawList.clear();
+
+    redrawing = true;
+}
+
+
+// Draw whole events until the time cursor or until the budget is spent - 0 means no limit
+bool Timeline::continueRedraw(int budgetMSec, int budgetPrimitives)
+{
+    KeyframeCache& keyframes = Canvas::si->keyframes;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    int primitives = 0;
+
+    // Work out everything up to the time cursor at once, on the worker threads - anything starting later isn't drawn
+    if (redrawList.isEmpty())
+    {
+        Event value(timeCursorMSec);
+
+        int end = qUpperBound(events.begin(), events.end(), &value, startTimeLessThan) - events.begin();
+
+        redrawList.build(events, eventToDrawIdx, qMax(end, eventToDrawIdx), timeCursorMSec);
+    }
+
+    for(; eventToDrawIdx < redrawList.getEnd(); eventToDrawIdx++)
     {
+        // Out of budget - carry on from this event next frame
+        if ((budgetMSec > 0 && elapsed.elapsed() >= budgetMSec) || (budgetPrimitives > 0 && primitives >= budgetPrimitives))
+        {
+            return false;
+        }
+
         eventToDraw = events[eventToDrawIdx];
 
+        const DrawList::Item& item = redrawList.at(eventToDrawIdx);
+
         if (eventToDraw->type == Event::STROKE_EVENT)
         {
-            hitCursor = ((PenStroke*)eventToDraw)->drawUntil(timeCursorMSec);
+            PenStroke* stroke = (PenStroke*)eventToDraw;
+
+            primitives += item.primitiveCount;
 
-            if (hitCursor) break;
+            if (item.visible) stroke->submit(0, item.toSubevent, stroke->pbStart, item.toPb, item.transform);
+
+            if (item.reachedTime)
+            {
+                Event::setSubeventIndex(item.toSubevent);
+                break;
+            }
         }
         else
         {
-            if (timeCursorMSec < eventToDraw->endTime) break;
+            if (item.reachedTime) break;
+        }
+
+        // An event still being recorded or dragged can't go into a keyframe, nor anything after it
+        if (eventToDraw->endTime < 0 || eventToDraw == Event::draggedEvent) redrawUseKeyframes = false;
+
+        redrawDoneTime = qMax(redrawDoneTime, eventToDraw->endTime);
+
+        if (redrawUseKeyframes && keyframes.wants(eventToDrawIdx + 1, redrawDoneTime))
+        {
+            StrokeRenderer::si->flushStrokeBatch();
+
+            keyframes.capture(eventToDrawIdx + 1, redrawDoneTime);
         }
     }
+
+    redrawList.clear();
+
+    redrawing = false;
+
+    return true;
+}
+
+
+void Timeline::redrawRegion(const QRectF &rect)
+{
+    // Keep the incremental draw where it was
+    int subeventIdx = Event::getSubeventIndex();
+
+    for (Event* ev : spatialIndex.query(rect))
+    {
+        if (ev->startTime > timeCursorMSec) break;
+
+        ((PenStroke*)ev)->drawUntil(timeCursorMSec);
+    }
+
+    Event::setSubeventIndex(subeventIdx);
+}
+
+
+void Timeline::updateDrawResumePoint()
+{
+    // A redraw in progress has its own resume point, past events that may just have moved. Start it over - the
+    // canvas clears the atlas and calls beginRedraw() with the GL context current
+    if (redrawing)
+    {
+        Canvas::si->requestRedraw();
+        return;
+    }
+
+    // Events are kept sorted by endTime and never overlap in time, so the first one still going on at the time
+    // cursor is where drawing stopped. Both hold as long as events are only added at the end or pasted between others
+    Event value(0);
+    value.endTime = timeCursorMSec;
+
+    eventToDrawIdx = qUpperBound(events.begin(), events.end(), &value, endTimeLessThan) - events.begin();
+
+    Event::setSubeventIndex(0);
+
+    if (eventToDrawIdx < events.size() && events[eventToDrawIdx]->type == Event::STROKE_EVENT)
+    {
+        PenStroke* stroke = (PenStroke*)events[eventToDrawIdx];
+
+        Event::setSubeventIndex(stroke->subevents.upperBound(timeCursorMSec));
+    }
+}
+
+
+void Timeline::invalidateFrom(int eventIdx)
+{
+    Canvas::si->keyframes.invalidateFrom(eventIdx);
+
+    // Built again from the edited events by the next budgeted frame
+    redrawList.clear();
+}
+
+
+void Timeline::damageEvents(int from, int to)
+{
+    for (int i = qMax(from, 0); i < qMin(to, events.size()); i++)
+    {
+        if (events[i]->startTime > timeCursorMSec) break;
+
+        if (events[i]->type == Event::STROKE_EVENT) Canvas::si->requestDamageRedraw(((PenStroke*)events[i])->getBounds());
+    }
 }
 
 
@@ -509,7 +664,7 @@ void Timeline::incrementalDraw()
             // Stop incrementing (break the loop) the event index for now, if the timecursor was hit
             if (hitLimit)
             {
-                if (isPlaying) cursorPosition = (eventToDraw->transform * SHRT_MAX) * eventToDraw->getCursorPos(timeCursorMSec);
+                if (isPlaying) cursorPosition = eventToDraw->transform.mapShrt(eventToDraw->getCursorPos(timeCursorMSec));
 
                 break;
             }
@@ -526,7 +681,7 @@ void Timeline::incrementalDraw()
 
             if (ev->type == Event::STROKE_EVENT || ev->type == Event::POINTER_MOVEMENT_EVENT)
             {
-                cursorPosition = (ev->transform * SHRT_MAX) * ev->getCursorPos(timeCursorMSec);
+                cursorPosition = ev->transform.mapShrt(ev->getCursorPos(timeCursorMSec));
 
                 qDebug()<<cursorPosition;
 
@@ -552,7 +707,17 @@ void Timeline::canvasPressedStart(QPointF penPos, int pboStart, int pbo)
         break;
 
     case MainWindow::POINTER_TOOL:
-        Canvas::si->pickingRequested = true;
+        // Rendering the ID colors on the GPU is kept only as a fallback
+        if (StrokeRenderer::si->gpuPicking)
+        {
+            Canvas::si->requestPicking();
+        }
+        else
+        {
+            Event::setActiveID(spatialIndex.pick(penPos, timeCursorMSec), penPos);
+
+            Canvas::si->update();
+        }
         return;
 
     default:
@@ -561,9 +726,13 @@ void Timeline::canvasPressedStart(QPointF penPos, int pboStart, int pbo)
 
     currentEvent = events.back();
 
+    invalidateFrom(events.size() - 1);
+
     dynamic_cast<PenStroke*>(currentEvent)->addStrokeEvent(timestamp, penPos.x(), penPos.y(), pbo);
 
-    Canvas::si->incrementalDrawRequested = true;
+    spatialIndex.update(currentEvent);
+
+    Canvas::si->requestIncrementalDraw();
 }
 
 
@@ -571,9 +740,19 @@ void Timeline::canvasPressedMove(QPointF penPos, int pbo)
 {
     if (MainWindow::si->activeTool == MainWindow::POINTER_TOOL)
     {
+        // The rest of the page is drawn once without the dragged event, which then moves over it
+        if (Event::activeEvent && Event::draggedEvent != Event::activeEvent)
+        {
+            invalidateFrom(events.indexOf(Event::activeEvent));
+
+            Canvas::si->beginDrag(Event::activeEvent);
+        }
+
         Event::handleDrag(Canvas::si->penPos - Canvas::si->lastPenPos);
 
-        Canvas::si->redrawRequested = true;
+        Canvas::si->liftStrokesOverDragged();
+
+        Canvas::si->update();
 
         return;
     }
@@ -582,13 +761,24 @@ void Timeline::canvasPressedMove(QPointF penPos, int pbo)
 
     ((PenStroke*)currentEvent)->addStrokeEvent(timestamp, penPos.x(), penPos.y(), pbo);
 
-    Canvas::si->incrementalDrawRequested = true;
+    spatialIndex.update(currentEvent);
+
+    Canvas::si->requestIncrementalDraw();
 }
 
 
 void Timeline::canvasPressedEnd()
 {
-    if (MainWindow::si->activeTool == MainWindow::POINTER_TOOL) return;
+    if (MainWindow::si->activeTool == MainWindow::POINTER_TOOL)
+    {
+        if (Event::draggedEvent)
+        {
+            spatialIndex.update(Event::draggedEvent);
+
+            Canvas::si->endDrag();
+        }
+        return;
+    }
 
     int timestamp = getCurrentTime();
 
@@ -606,6 +796,8 @@ void Timeline::canvasHoverStart(QPointF penPos)
 
     currentEvent = events.back();
 
+    invalidateFrom(events.size() - 1);
+
     dynamic_cast<PointerMovement*>(currentEvent)->addPointerEvent(timestamp, penPos.x(), penPos.y());
 }
 
@@ -660,7 +852,7 @@ void Timeline::exportVideo()
 
     QDataStream out(&videoFile);
 
-    out << (qint16) 0; // Video File version number - to prevent compatibility issues
+    out << (qint16) VIDEO_FILE_VERSION; // Video File version number - to prevent compatibility issues
 //    out << videoNameSize; //TODO
 //    out << "videoName";
 
@@ -685,3 +877,179 @@ void Timeline::exportVideo()
 
     videoFile.close();
 }
+
+
+// Replace the lecture with the one in a file written by exportVideo - the audio isn't part of it
+bool Timeline::loadVideo(const QString &fileName)
+{
+    // The audio is sized for the lecture in the probed format
+    if (isRecording || isPlaying || !audioInput) return false;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QFile videoFile(fileName);
+    if (!videoFile.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream in(&videoFile);
+
+    qint16 version;
+    in >> version;
+
+    // Whatever exists now goes once the file is loaded - the lecture, the clipboard and any event in between
+    QVector<Event*> previous = EventRegistry::getEvents();
+
+    QVector<Event*> loaded, created;
+    PenStroke* stroke = NULL;
+    PointerMovement* pointer = NULL;
+    bool valid = version <= VIDEO_FILE_VERSION;
+
+    while (valid && !in.atEnd())
+    {
+        qint32 t;
+        qint8 type;
+        in >> t >> type;
+
+        switch (type)
+        {
+        case Event::STROKE_START:
+        {
+            quint8 r, g, b, size = 3;
+            in >> r >> g >> b;
+            if (version >= 1) in >> size;
+
+            stroke = new PenStroke(t, r / 255.0f, g / 255.0f, b / 255.0f, size);
+            created << stroke;
+            break;
+        }
+        case Event::STROKE_EVENT:
+        {
+            qint16 x, y;
+            in >> x >> y;
+
+            if (stroke) stroke->addStrokeEvent(t, x, y, 0);
+            else valid = false;
+            break;
+        }
+        case Event::STROKE_END:
+            if (stroke && !stroke->subevents.isEmpty())
+            {
+                stroke->closeStrokeEvent(t);
+                loaded << stroke;
+            }
+            else valid = false;
+
+            stroke = NULL;
+            break;
+
+        case Event::POINTER_MOVEMENT_START:
+            pointer = new PointerMovement(t);
+            created << pointer;
+            break;
+
+        case Event::POINTER_MOVEMENT_EVENT:
+        {
+            qint16 x, y;
+            in >> x >> y;
+
+            if (pointer) pointer->addPointerEvent(t, x, y);
+            else valid = false;
+            break;
+        }
+        case Event::POINTER_MOVEMENT_END:
+            if (pointer)
+            {
+                pointer->closePointerEvent(t);
+                loaded << pointer;
+            }
+            else valid = false;
+
+            pointer = NULL;
+            break;
+
+        default:
+            valid = false;
+            break;
+        }
+
+        if (in.status() != QDataStream::Ok) valid = false;
+    }
+
+    if (!valid || stroke || pointer)
+    {
+        qWarning() << "Not a valid video file:" << fileName;
+
+        qDeleteAll(created);
+
+        return false;
+    }
+
+    // Drop the current lecture, clipboard included - the loaded events keep their handles
+    unselect();
+
+    currentEvent = NULL;
+    eventsClipboard.clear();
+
+    qDeleteAll(previous);
+
+    events = loaded;
+
+    // No stroke draws the old segments anymore
+    StrokeRenderer::si->clearSegments();
+
+    // Their sprites are made here, all at once
+    StrokeRenderer::si->regenerateSprites(events);
+
+    spatialIndex.rebuild(events);
+
+    Canvas::si->keyframes.invalidateAll();
+    redrawList.clear();
+
+    // Show the whole lecture
+    totalTimeRecorded = 0;
+    for (Event* ev : events) totalTimeRecorded = qMax(totalTimeRecorded, (long)ev->endTime);
+
+    timeCursorMSec = totalTimeRecorded;
+
+    // The previous session's audio goes too. The lecture plays against silence as long as it is, so recording
+    // carries on after its last event and events stay sorted without overlapping
+    qint64 audioBytes = (qint64)(totalTimeRecorded * samplingFrequency / 1000.0) * sampleSize;
+
+    getRawAudioFile()->resize(0);
+    getRawAudioFile()->resize(audioBytes);
+    getRawAudioFile()->seek(audioBytes);
+
+    audioClipboard.clear();
+    getAudioPixmap()->fill(timelineColor);
+
+    getVideoPixmap()->fill(timelineColor);
+
+    for (Event* ev : events)
+    {
+        if (ev->type != Event::STROKE_EVENT) continue;
+
+        currentEvent = ev;
+        paintVideoPixmap();
+    }
+
+    currentEvent = NULL;
+
+    updateDrawResumePoint();
+
+    Canvas::si->requestRedraw();
+    update();
+
+    // What the subevent columns take, to compare lectures by
+    qint64 subeventBytes = 0;
+
+    for (Event* ev : events)
+    {
+        if (ev->type == Event::STROKE_EVENT) subeventBytes += ((PenStroke*)ev)->subevents.getBytesUsed();
+        if (ev->type == Event::POINTER_MOVEMENT_EVENT) subeventBytes += ((PointerMovement*)ev)->subevents.getBytesUsed();
+    }
+
+    qDebug() << "Loaded" << events.size() << "events from" << fileName << "in" << elapsed.elapsed() << "ms,"
+             << subeventBytes / 1024 << "KB of subevents";
+
+    return true;
+}